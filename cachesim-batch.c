@@ -0,0 +1,386 @@
+// file: cachesim-batch.c
+// author : Ryu Hyung Uk
+// description : Program to run many (trace, cache configuration) jobs of cachesim-onelevel in parallel
+// usage: ./cachesim-batch -f=<manifest file> -o=<result file> [-j=<worker count>] [-M=<memory limit(in MB)>]
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// simulator is compiled into this program, so each job only costs fork() (no exec, no text output parsing)
+// forked child has its own copy of simulator globals, which makes it a private simulator instance
+#define CACHESIM_LIBRARY
+#include "cachesim-onelevel.c"
+
+#define MAX_JOB_ARGS 32
+#define MAX_LINE 4096
+#define RESULT_SIZE 4096
+#define JOB_BASE_MEMORY (8 * 1024 * 1024) // memory of one simulator process besides its cache arena
+#define JOB_WAITING 0 // job status
+#define JOB_RUNNING 1
+#define JOB_DONE 2
+#define JOB_FAILED 3
+
+
+// define structure
+typedef struct JOB {
+    char* trace;
+    int cache_size, set_size, block_size;
+    char* options; // extra simulator options (verbatim, for result file)
+    int argc;
+    char* argv[MAX_JOB_ARGS];
+    off_t trace_bytes; // trace length estimate for largest-first scheduling
+    size_t memory; // estimated peak memory of job
+    int status;
+    pid_t pid;
+    FILE* out; // stdout of simulator process
+    double start_time, elapsed;
+    char output[RESULT_SIZE]; // csv output of simulator
+} JOB;
+
+
+// define global variables
+JOB* jobs = NULL;
+JOB** order = NULL;
+int job_count = 0, job_capacity = 0, worker_count = 0;
+size_t memory_limit = 0; // 0: unlimited
+
+
+// define functions
+void batch_usage(char*);
+double now();
+size_t estimatememory(JOB*);
+int addjob(const char*, int, int, int, const char*);
+void readmanifest(const char*);
+int jobresult(JOB*, double*, double*);
+int compare_trace_bytes(const void*, const void*);
+void startjob(JOB*);
+void finishjob(JOB*, int);
+void runjobs();
+void writeresult(const char*);
+
+
+// print usage and terminate program
+void batch_usage(char* program_name) {
+    printf("Usage: %s -f=<manifest file> -o=<result file> [-j=<worker count>] [-M=<memory limit(in MB)>]\n", program_name);
+    puts("manifest line: <trace file> <cache size(in Bytes)> <set size> <block size(in Bytes)> [cachesim-onelevel options...]");
+    exit(1);
+}
+
+// return monotonic time in seconds
+double now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// estimate memory of job from the cache arena and option-dependent structures it will allocate
+// memory image of written-back words grows with the trace footprint and is not included
+size_t estimatememory(JOB* job) {
+    size_t blocks = (size_t)job->cache_size / job->block_size;
+    size_t sets = blocks / job->set_size;
+    size_t words = job->block_size / WORDSIZE;
+    size_t memory = JOB_BASE_MEMORY;
+    int compress = FALSE, tags = 2, victims = 0, buckets = 1;
+    char mode[16];
+
+    // options are checked in order, so the last one wins as in parseargv
+    for (int i = 0; i < job->argc; i++) {
+        if (sscanf(job->argv[i], "-compress=%15s", mode) == 1)
+            compress = strcmp(mode, "none") != 0;
+        sscanf(job->argv[i], "-tags=%d", &tags);
+        sscanf(job->argv[i], "-victim=%d", &victims);
+    }
+
+    // compression multiplies tag entries (each with data) by -tags and adds tag-only uncompressed shadow
+    if (compress)
+        memory += blocks * sizeof(BLOCK) + blocks * tags * (sizeof(BLOCK) + sizeof(int) * words);
+    else
+        memory += blocks * (sizeof(BLOCK) + sizeof(int) * words);
+    memory += sets * (sizeof(SET) + 2 * sizeof(uint64_t)); // per-set statistics
+
+    // victim buffer entries, their data and hash table
+    if (victims > 0) {
+        for (; buckets < 2 * victims; buckets <<= 1);
+        memory += victims * sizeof(VICTIM) + buckets * sizeof(int) + (victims + 1) * words * sizeof(int);
+    }
+    return memory;
+}
+
+// append job to job list and return its index
+int addjob(const char* trace, int cache_size, int set_size, int block_size, const char* options) {
+    char arg[MAX_LINE], buf[MAX_LINE];
+    char* tok = NULL;
+    struct stat st;
+    JOB* job = NULL;
+
+    if (job_count == job_capacity) {
+        job_capacity = job_capacity ? job_capacity * 2 : 16;
+        jobs = (JOB*)realloc(jobs, sizeof(JOB) * job_capacity);
+    }
+    job = &jobs[job_count];
+    memset(job, 0, sizeof(JOB));
+    job->trace = strdup(trace);
+    job->cache_size = cache_size;
+    job->set_size = set_size;
+    job->block_size = block_size;
+    job->options = strdup(options);
+
+    // build argument list of cachesim_main
+    job->argv[job->argc++] = "cachesim-onelevel";
+    snprintf(arg, sizeof(arg), "-s=%d", cache_size);
+    job->argv[job->argc++] = strdup(arg);
+    snprintf(arg, sizeof(arg), "-a=%d", set_size);
+    job->argv[job->argc++] = strdup(arg);
+    snprintf(arg, sizeof(arg), "-b=%d", block_size);
+    job->argv[job->argc++] = strdup(arg);
+    snprintf(arg, sizeof(arg), "-f=%s", trace);
+    job->argv[job->argc++] = strdup(arg);
+
+    snprintf(buf, sizeof(buf), "%s", options);
+    for (tok = strtok(buf, " \t\r\n"); tok; tok = strtok(NULL, " \t\r\n")) {
+        if (job->argc >= MAX_JOB_ARGS - 2)
+            return -1;
+        job->argv[job->argc++] = strdup(tok);
+    }
+    job->argv[job->argc++] = strdup("-o=csv"); // last one wins (parseargv modifies arguments)
+    job->argv[job->argc] = NULL;
+
+    job->trace_bytes = stat(trace, &st) == 0 ? st.st_size : 0;
+    job->memory = estimatememory(job);
+    job->status = JOB_WAITING;
+    return job_count++;
+}
+
+// read (trace, configuration) jobs from manifest file
+void readmanifest(const char* file_name) {
+    FILE* fp = fopen(file_name, "r");
+    char line[MAX_LINE], options[MAX_LINE];
+    char* trace = NULL;
+    char* tok = NULL;
+    int cache_size = 0, set_size = 0, block_size = 0;
+
+    if (fp == NULL) {
+        printf("Cannot open manifest file: %s\n", file_name);
+        exit(1);
+    }
+
+    for (int lineno = 1; fgets(line, sizeof(line), fp); lineno++) {
+        trace = strtok(line, " \t\r\n");
+        if (trace == NULL || trace[0] == '#')
+            continue; // skip blank line and comment
+
+        tok = strtok(NULL, " \t\r\n");
+        cache_size = tok ? atoi(tok) : 0;
+        tok = strtok(NULL, " \t\r\n");
+        set_size = tok ? atoi(tok) : 0;
+        tok = strtok(NULL, " \t\r\n");
+        block_size = tok ? atoi(tok) : 0;
+        if (cache_size <= 0 || set_size <= 0 || block_size <= 0) {
+            printf("%s:%d: invalid job\n", file_name, lineno);
+            exit(1);
+        }
+
+        // rest of line is passed to simulator
+        options[0] = '\0';
+        while ((tok = strtok(NULL, " \t\r\n"))) {
+            if (options[0])
+                strcat(options, " ");
+            strncat(options, tok, sizeof(options) - strlen(options) - 1);
+        }
+        if (addjob(trace, cache_size, set_size, block_size, options) < 0) {
+            printf("%s:%d: too many options\n", file_name, lineno);
+            exit(1);
+        }
+    }
+    fclose(fp);
+}
+
+// parse miss rate and IPC from csv output of finished job, return FALSE if job failed
+int jobresult(JOB* job, double* miss_rate, double* ipc) {
+    char* row = strstr(job->output, "accesses,memory_accesses");
+    double hit_rate = 0;
+    long long v[6];
+
+    if (job->status != JOB_DONE || row == NULL || (row = strchr(row, '\n')) == NULL)
+        return FALSE;
+    return sscanf(row + 1, "%lld,%lld,%lld,%lld,%lld,%lld,%lf,%lf,%lf", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &hit_rate, miss_rate, ipc) == 9;
+}
+
+// order jobs from longest trace to shortest
+int compare_trace_bytes(const void* a, const void* b) {
+    off_t x = (*(JOB**)a)->trace_bytes, y = (*(JOB**)b)->trace_bytes;
+
+    return (x < y) - (x > y);
+}
+
+// fork simulator process for job, its output goes to temporary file
+void startjob(JOB* job) {
+    job->out = tmpfile();
+    if (job->out == NULL) {
+        perror("tmpfile");
+        exit(1);
+    }
+    fflush(stdout);
+    fflush(stderr);
+
+    job->pid = fork();
+    if (job->pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (job->pid == 0) {
+        dup2(fileno(job->out), STDOUT_FILENO);
+        exit(cachesim_main(job->argc, job->argv));
+    }
+
+    job->status = JOB_RUNNING;
+    job->start_time = now();
+}
+
+// collect csv output of finished job
+void finishjob(JOB* job, int wstatus) {
+    long size = 0;
+    size_t total = 0;
+
+    // csv rows are printed last, so tail of output is enough (-i may print more before them)
+    fseek(job->out, 0, SEEK_END);
+    size = ftell(job->out);
+    fseek(job->out, size > RESULT_SIZE - 1 ? size - (RESULT_SIZE - 1) : 0, SEEK_SET);
+    total = fread(job->output, 1, RESULT_SIZE - 1, job->out);
+    job->output[total] = '\0';
+    fclose(job->out);
+
+    job->elapsed = now() - job->start_time;
+    if (WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0 && strstr(job->output, "accesses,memory_accesses"))
+        job->status = JOB_DONE;
+    else
+        job->status = JOB_FAILED;
+}
+
+// run every waiting job on worker_count processes, longest trace first, within memory_limit
+void runjobs() {
+    int running = 0, finished = 0, waiting = 0, wstatus = 0;
+    size_t memory_used = 0;
+    pid_t pid = 0;
+    JOB* job = NULL;
+
+    // largest-first dispatch keeps every worker busy when trace lengths vary widely:
+    // long jobs start early, short jobs fill the gaps at the end
+    order = (JOB**)realloc(order, sizeof(JOB*) * job_count);
+    for (int i = 0; i < job_count; i++) {
+        order[i] = &jobs[i];
+        waiting += (jobs[i].status == JOB_WAITING);
+    }
+    qsort(order, job_count, sizeof(JOB*), compare_trace_bytes);
+
+    while (finished < waiting) {
+        // start waiting jobs while worker and memory are free (job larger than limit runs alone)
+        for (int i = 0; i < job_count && running < worker_count; i++) {
+            job = order[i];
+            if (job->status != JOB_WAITING)
+                continue;
+            if (memory_limit && running > 0 && memory_used + job->memory > memory_limit)
+                continue;
+            startjob(job);
+            memory_used += job->memory;
+            running++;
+        }
+
+        // wait for any job to finish
+        pid = waitpid(-1, &wstatus, 0);
+        if (pid < 0) {
+            perror("waitpid");
+            exit(1);
+        }
+        for (int i = 0; i < job_count; i++) {
+            job = &jobs[i];
+            if (job->status == JOB_RUNNING && job->pid == pid) {
+                finishjob(job, wstatus);
+                memory_used -= job->memory;
+                running--;
+                finished++;
+                fprintf(stderr, "[%d/%d] %s %s -s=%d -a=%d -b=%d %s (%.2fs)\n", finished, waiting,
+                    job->status == JOB_DONE ? "done" : "FAILED", job->trace, job->cache_size, job->set_size, job->block_size,
+                    job->options, job->elapsed);
+                break;
+            }
+        }
+    }
+}
+
+// write one csv file with result of every job (manifest order)
+void writeresult(const char* file_name) {
+    FILE* fp = fopen(file_name, "w");
+    char* row = NULL;
+    int header_written = FALSE;
+
+    if (fp == NULL) {
+        printf("Cannot open result file: %s\n", file_name);
+        exit(1);
+    }
+
+    for (int i = 0; i < job_count; i++) {
+        // simulator output: csv header line, then csv row
+        row = strstr(jobs[i].output, "accesses,memory_accesses");
+        if (row)
+            row = strchr(row, '\n');
+        if (row)
+            *row++ = '\0';
+
+        if (!header_written && jobs[i].status == JOB_DONE) {
+            fprintf(fp, "trace,cache_size,set_size,block_size,options,status,seconds,%s\n", strstr(jobs[i].output, "accesses,memory_accesses"));
+            header_written = TRUE;
+        }
+        fprintf(fp, "%s,%d,%d,%d,\"%s\",%s,%.3f,%s", jobs[i].trace, jobs[i].cache_size, jobs[i].set_size, jobs[i].block_size,
+            jobs[i].options, jobs[i].status == JOB_DONE ? "ok" : "failed", jobs[i].elapsed, jobs[i].status == JOB_DONE && row ? row : "\n");
+    }
+    fclose(fp);
+}
+
+
+// cachesim-search.c includes this file with CACHESIM_BATCH_LIBRARY defined to reuse the job runner
+#ifndef CACHESIM_BATCH_LIBRARY
+int main(int argc, char* argv[]) {
+    char* ch = NULL;
+    char* value = NULL;
+    char* manifest_name = NULL;
+    char* result_name = NULL;
+    int failed = 0;
+
+    worker_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    // parse passed argument
+    for (int i = 1; i < argc; i++) {
+        ch = strtok(argv[i], "=-");
+        value = strtok(NULL, "\0");
+        if (ch == NULL || value == NULL)
+            batch_usage(argv[0]);
+
+        if (!strcmp(ch, "f"))
+            manifest_name = value;
+        else if (!strcmp(ch, "o"))
+            result_name = value;
+        else if (!strcmp(ch, "j"))
+            worker_count = atoi(value);
+        else if (!strcmp(ch, "M"))
+            memory_limit = (size_t)atol(value) * 1024 * 1024;
+        else
+            batch_usage(argv[0]);
+    }
+    if (manifest_name == NULL || result_name == NULL || worker_count <= 0)
+        batch_usage(argv[0]);
+
+    readmanifest(manifest_name);
+    runjobs();
+    writeresult(result_name);
+
+    for (int i = 0; i < job_count; i++)
+        failed += (jobs[i].status != JOB_DONE);
+    printf("%d jobs, %d failed, results written to %s\n", job_count, failed, result_name);
+
+    return failed ? 1 : 0;
+}
+#endif
@@ -1,7 +1,7 @@
 // file: cachesim-onelevel.c
 // author : Ryu Hyung Uk
 // description : Program to simulate one level cache
-// usage: ./cachesim-onelevel -s=<cache size(in Bytes)> -a=<set size> -b=<block size(in Bytes)> -f=<trace file name>
+// usage: ./cachesim-onelevel -s=<cache size(in Bytes)> -a=<set size> -b=<block size(in Bytes)> (-f=<trace file name> | -m=<shared memory name>) [-i=<stats interval>]
 
 #define TRUE 1
 #define FALSE 0
@@ -13,22 +13,103 @@
 #define CYCLE_CACHE_HIT 5
 #define CYCLE_MEM_ACC 100
 #define verbose FALSE // trigger verbose output
+#define CACHESIM_VERSION "1.3" // bump when simulation results change (invalidates result store)
+#define ARENA_ALIGN 64 // alignment of each region in cache arena (cache line)
+#define HUGEPAGE_SIZE (2 * 1024 * 1024)
+#define PAGE_NORMAL 0 // arena backing pages
+#define PAGE_THP 1
+#define PAGE_HUGETLB 2
+#define MISS_MAGIC "CSMT" // miss trace file
+#define MISS_VERSION 2 // 2: 64-Bit gap
+#define MISS_FILL 0 // miss trace record types (low 2 bits of block address)
+#define MISS_WRITEBACK 1
+#define MISS_RESIDENT 2 // block left in cache at end of trace
+#define MISS_RESIDENT_DIRTY 3 // .. with writeback still pending
+#define OUTPUT_TEXT 0 // result output format
+#define OUTPUT_CSV 1
+#define PROF_PARSE 0 // profiled stages (--profile, needs -DCACHESIM_PROFILE)
+#define PROF_LOOKUP 1
+#define PROF_MISS 2
+#define PROF_MEMORY 3
+#define PROF_REPORT 4
+#define PROF_STAGES 5
+#define FINGERPRINT_SAMPLE 0 // trace fingerprint: size, mtime and sampled hash
+#define FINGERPRINT_FULL 1 // .. hash of whole file
+#define SAMPLE_SIZE (64 * 1024)
+#define CYCLE_TLB2_HIT 7 // L1 TLB hit is hidden behind cache access
+#define CYCLE_PAGE_WALK 30 // per page table level, when walk is not injected into cache
+#define VIRT_BITS 57 // virtual address bits mapped by -map=random|color (5-level paging)
+#define PHYS_REGION_BITS 2 // top bits of physical address select region: 4K, 2M, 1G pages or page tables
+#define PHYS_BITS (VIRT_BITS + PHYS_REGION_BITS) // physical address bits, each region as large as virtual space
+#define PAGE_TABLE_BASE ((uint64_t)3 << VIRT_BITS) // physical region holding page tables
+#define MAP_IDENTITY 0 // virtual to physical page mapping policy
+#define MAP_RANDOM 1
+#define MAP_COLOR 2 // random, but keeps cache index bits above page offset (page coloring)
+#define INDEX_MODULO 0 // set index function: bits above block offset
+#define INDEX_XOR 1 // xor of every index-wide field of block number
+#define INDEX_PRIME 2 // block number modulo largest prime <= set count
+#define INDEX_SKEW 3 // different hash per way (skewed-associative)
+#define HIST_BUCKETS 65 // 0, then [2^(k-1), 2^k) for k = 1..64 (whole uint64_t range)
+#define COMPRESS_NONE 0 // block compression (-compress)
+#define COMPRESS_ZERO 1 // zero-block detection
+#define COMPRESS_BDI 2 // base-delta-immediate
+#define COMPRESS_FPC 3 // frequent pattern compression
+#define COMPRESS_SEGMENT 8 // compressed blocks are stored in 8-Byte segments
+#define CYCLE_DECOMPRESS_BDI 1 // default decompression latency
+#define CYCLE_DECOMPRESS_FPC 5
+#define SECTOR_MAX 64 // sectors per block (-sector), one bit each in BLOCK sector masks
+#define CYCLE_VICTIM_HIT 1 // default extra latency of victim buffer hit
+#define MEM_INITIAL 1024 // initial capacity of memory hash table (power of 2)
+#define MEM_MAX ((uint32_t)1 << 31) // words held by memory hash table
+#define MEM_NONE UINT32_MAX // end of memory hash chain
+#define ALIGN_UP(x, a) (((x) + (a) - 1) / (a) * (a))
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cachesim-shm.h"
+#ifdef CACHESIM_PROFILE
+#include <sys/resource.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#endif
+
+
+// scoped stage timers, compiled out unless built with -DCACHESIM_PROFILE
+#ifdef CACHESIM_PROFILE
+#define PROF_BEGIN(stage) uint64_t prof_start_##stage = profile ? prof_now() : 0
+#define PROF_END(stage) \
+    if (profile) { \
+        prof_ticks[stage] += prof_now() - prof_start_##stage; \
+        prof_calls[stage]++; \
+    }
+#else
+#define PROF_BEGIN(stage)
+#define PROF_END(stage)
+#endif
 
 
 // define structure
 typedef struct SET {
     struct BLOCK* block;
+    int mru; // most recently hit or filled way (way prediction)
 } SET;
 
 typedef struct BLOCK {
-    int fetched_time;
+    uint64_t fetched_time;
     uint64_t tag;
     int valid;
     int dirty;
+    int size; // stored size in Bytes (compressed under -compress)
+    uint64_t sector_valid; // one bit per sector (single sector unless -sector)
+    uint64_t sector_dirty;
     int* data;
 } BLOCK;
 
@@ -39,27 +120,131 @@ typedef struct ADDRESS {
     uint64_t byte;
 } ADDRESS;
 
+typedef struct MISSHEADER {
+    char magic[4]; // MISS_MAGIC
+    uint32_t version;
+    uint32_t cache_size; // geometry of cache which produced the trace
+    uint32_t set_size;
+    uint32_t block_size;
+    uint32_t sector_size; // size of FILL and WRITEBACK records when sectored, 0: block_size
+} MISSHEADER;
+
+typedef struct RESULTFIELD {
+    const char* name;
+    uint64_t* value;
+} RESULTFIELD;
+
+typedef struct TLBENTRY {
+    uint64_t vpn; // virtual page number
+    uint64_t lastused; // for LRU replacement
+    int shift; // log2 of page size
+    int valid;
+} TLBENTRY;
+
+typedef struct TLB {
+    int entries, ways, sets;
+    TLBENTRY* entry; // sets * ways
+} TLB;
+
+typedef struct VICTIM {
+    uint64_t blockaddr; // start address of block
+    int dirty;
+    int prev, next; // LRU list (next is towards LRU end), next also links free entries
+    int hnext; // next entry in same hash bucket
+    int* data;
+} VICTIM;
+
 typedef struct MEMORY {
-    struct MEMDATA* head;
-    struct MEMDATA* tail;
+    struct MEMDATA* entry; // written words in order of first write
+    uint32_t* bucket; // hash table of entry indices
+    uint32_t count;
+    uint32_t capacity; // entries and buckets, power of 2 (load factor <= 1)
 } MEMORY;
 
 typedef struct MEMDATA {
     uint64_t address;
-    uint64_t data;
-    struct MEMDATA* prev;
-    struct MEMDATA* next;
+    int data;
+    uint32_t next; // next entry in same bucket, MEM_NONE at end of chain
 } MEMDATA;
 
 
 // define global variables
-int timecnt = 1;
+uint64_t timecnt = 1;
 int cache_size = 0, block_size = 0, set_size = 0;
-int total_cycle = 0, hit_count = 0, miss_count = 0;
+uint64_t total_cycle = 0, hit_count = 0, miss_count = 0;
 int index_total = 0, index_bit = 0, word_count = 0;
 int byte_offset = 0, tag_bit = 0;
-int insType = 0, insCnt = 0;
-int mem_acc_count = 0;
+uint64_t byte_mask = 0, index_mask = 0, tag_mask = 0; // precomputed by initcache
+int index_func = INDEX_MODULO, index_prime = 1, set_hist = FALSE;
+uint64_t* set_access_count = NULL; // per-set statistics (in arena)
+uint64_t* set_conflict_count = NULL;
+int compress_mode = COMPRESS_NONE, tag_factor = 2, decompress_latency = -1;
+int data_ways = 0, set_budget = 0; // blocks worth of data per set (-a) and its size in Bytes
+int valid_blocks = 0, stored_bytes = 0; // resident blocks and their stored size
+uint64_t valid_block_sum = 0, stored_byte_sum = 0; // summed on every access (time average)
+uint64_t decompress_count = 0, compress_evict_count = 0;
+BLOCK* shadow = NULL; // tag-only uncompressed cache of same geometry (baseline under -compress)
+uint64_t shadow_timecnt = 1, shadow_miss_count = 0, shadow_mem_acc_count = 0;
+int sector_size = 0, sector_words = 0, sector_count = 1; // -sector, 0: block is single sector
+uint64_t sector_miss_count = 0; // misses of block whose tag was present
+uint64_t mem_read_bytes = 0, mem_write_bytes = 0;
+VICTIM* victim_buffer = NULL; // fully associative buffer of evicted blocks (-victim)
+int* victim_bucket = NULL; // hash table of victim_buffer, -1 terminated chains
+int* victim_scratch = NULL; // block data while swapping with main cache, followed by data of every entry
+int victim_entries = 0, victim_buckets = 0, victim_latency = CYCLE_VICTIM_HIT, victim_swap = TRUE;
+int victim_mru = -1, victim_lru = -1, victim_free = -1;
+uint64_t victim_hit_count = 0, victim_writeback_count = 0;
+int insType = 0;
+uint64_t insCnt = 0;
+uint64_t mem_acc_count = 0;
+uint64_t record_count = 0, stats_interval = 0, record_limit = 0;
+uint64_t progress_interval = 0; // -progress, records between progress reports
+struct timespec progress_start;
+char* shm_name = NULL;
+int page_mode = PAGE_NORMAL;
+void* arena = NULL; // single allocation holding every SET, BLOCK and block data
+size_t arena_size = 0;
+void (*set_address_kernel)(ADDRESS*, uint64_t) = NULL; // selected by selectkernel
+int (*isHit_kernel)(ADDRESS, int*) = NULL;
+int (*tagsearch_kernel)(ADDRESS, int*) = NULL; // full tag search behind way prediction
+int way_predict = FALSE;
+uint64_t last_index = 0, last_tag = 0; // block accessed by previous record (same-block filter)
+int last_way = -1;
+uint64_t filter_hit_count = 0, predict_count = 0, predict_hit_count = 0;
+FILE* emit_fp = NULL; // miss trace output
+int miss_input = FALSE, drain_resident = FALSE;
+uint64_t emit_count = 0, resident_count = 0, resident_dirty_count = 0;
+uint64_t emit_last_insCnt = 0;
+int output_mode = OUTPUT_TEXT;
+int profile = FALSE;
+#ifdef CACHESIM_PROFILE
+uint64_t prof_ticks[PROF_STAGES] = { 0 }, prof_calls[PROF_STAGES] = { 0 };
+uint64_t prof_start_tick = 0;
+struct timespec prof_start_time;
+#endif
+TLB tlb[2]; // L1 and L2 TLB
+int tlb_levels = 0; // 0: addresses in trace are physical
+int page_mix[3] = { 100, 0, 0 }; // share(%) of 4K, 2M and 1G pages
+int walk_cycles = CYCLE_PAGE_WALK, inject_walk = FALSE, map_policy = MAP_IDENTITY;
+uint64_t tlb_time = 0;
+uint64_t tlb_hit_count[2] = { 0, 0 }, tlb_miss_count[2] = { 0, 0 };
+uint64_t walk_count = 0, walk_cycle_count = 0, walk_access_count = 0;
+char* result_dir = NULL; // persistent result store
+int fingerprint_mode = FINGERPRINT_SAMPLE;
+RESULTFIELD result_field[] = { // statistics kept in result store
+    { "hit_count", &hit_count }, { "miss_count", &miss_count }, { "mem_acc_count", &mem_acc_count },
+    { "total_cycle", &total_cycle }, { "insCnt", &insCnt }, { "filter_hit_count", &filter_hit_count },
+    { "predict_count", &predict_count }, { "predict_hit_count", &predict_hit_count },
+    { "resident_count", &resident_count }, { "resident_dirty_count", &resident_dirty_count },
+    { "tlb1_hit_count", &tlb_hit_count[0] }, { "tlb1_miss_count", &tlb_miss_count[0] },
+    { "tlb2_hit_count", &tlb_hit_count[1] }, { "tlb2_miss_count", &tlb_miss_count[1] },
+    { "walk_count", &walk_count }, { "walk_cycle_count", &walk_cycle_count }, { "walk_access_count", &walk_access_count },
+    { "decompress_count", &decompress_count }, { "compress_evict_count", &compress_evict_count },
+    { "shadow_miss_count", &shadow_miss_count }, { "shadow_mem_acc_count", &shadow_mem_acc_count },
+    { "valid_block_sum", &valid_block_sum }, { "stored_byte_sum", &stored_byte_sum },
+    { "sector_miss_count", &sector_miss_count }, { "mem_read_bytes", &mem_read_bytes }, { "mem_write_bytes", &mem_write_bytes },
+    { "victim_hit_count", &victim_hit_count }, { "victim_writeback_count", &victim_writeback_count },
+};
 SET* cache = NULL;
 BLOCK* block = NULL;
 MEMORY* MEMptr = NULL;
@@ -67,19 +252,77 @@ MEMORY* MEMptr = NULL;
 
 // define functions
 int log_2(int);
+void usage(char*);
 void parseargv(int, char**, int*, int*, int*, char**);
 MEMDATA* getMemdata(MEMORY*, uint64_t);
 void setMemdata(MEMORY*, uint64_t, int);
-void printMemdata(MEMORY*, int, int);
+void growmemory(MEMORY*);
+int compareaddress(const void*, const void*);
+void printMemory(MEMORY*);
+void* allocarena(size_t);
 void initcache();
-void set_address();
+void set_address(ADDRESS*, uint64_t);
 uint64_t getmask(int start, int cnt);
+uint64_t blocktoint(uint64_t, uint64_t);
+uint64_t setindex(uint64_t, int);
+uint64_t wayset(ADDRESS, int);
+BLOCK* blockat(ADDRESS, int);
 int isHit(ADDRESS, int*);
-int fetchblock(ADDRESS, int);
+int isHit_predicted(ADDRESS, int*);
+void selectkernel();
+int fetchblock(ADDRESS, int, int);
+void evictblock(ADDRESS, int);
+void memtransfer(int, int);
+void writeback(uint64_t, int*, uint64_t);
+void initvictim();
+int victimhit(ADDRESS);
+void victimunlink(int);
+void victimlinkmru(int);
+void victimtouch(int);
+void victiminsert(uint64_t, int*, int);
+int bdibits(int*);
+int fpcbits(int*);
+int compressedsize(int*);
+void makeroom(ADDRESS, int);
+void shadowaccess(ADDRESS, int);
 void write_to_cache(ADDRESS, int);
 int read_from_cache(ADDRESS);
 void printresult(int);
+void printstats();
+void printcsv();
+void printsethist();
+void printcompress();
+void printsector();
+void printvictim();
+void printprogress(int);
+void simulate(char, uint64_t, uint64_t, int*);
+int readvalue(FILE*, int*);
+SHMRING* attach_shm(const char*);
+void consume_shm(SHMRING*);
+void openemit(const char*);
+void emitrecord(int, uint64_t);
+void closeemit();
+void simulate_miss(int, uint64_t, uint64_t, uint32_t);
+void readmisstrace(FILE*, MISSHEADER*);
 void deallocate();
+void inittlb();
+uint64_t mix64(uint64_t);
+int pageshift(uint64_t);
+int tlblookup(TLB*, uint64_t, int);
+void tlbinsert(TLB*, uint64_t, int);
+uint64_t permutebits(uint64_t, int);
+uint64_t physframe(uint64_t, int);
+void pagewalk(uint64_t, int);
+uint64_t translate(uint64_t);
+uint64_t hashbytes(uint64_t, const unsigned char*, size_t);
+uint64_t resultkey(const char*);
+int loadresult(uint64_t);
+void storeresult(uint64_t);
+int cachesim_main(int, char**);
+#ifdef CACHESIM_PROFILE
+uint64_t prof_now();
+void printprofile();
+#endif
 
 
 // perform log_2 operation
@@ -90,39 +333,180 @@ int log_2(int num) {
     return result;
 }
 
+// print usage and terminate program
+void usage(char* program_name) {
+    printf("Usage: %s -s=<cache size(in Bytes)> -a=<set size> -b=<block size(in Bytes)> (-f=<trace file name> | -m=<shared memory name>)\n", program_name);
+    puts("       [-i=<stats interval(in records)>] [-p=<none|thp|huge>] [-w=<0|1>] [-e=<miss trace output>] [-d=<0|1>] [-o=<text|csv>]");
+    puts("       [--profile] [-c=<result store directory>] [-F=<sample|full>] [-n=<record limit>]");
+    puts("       [-tlb1=<entries>:<ways> [-tlb2=<entries>:<ways>] [-pages=4k:<%>,2m:<%>,1g:<%>] [-walk=<cycles per level>]");
+    puts("        [-inject=<0|1>] [-map=<identity|random|color>]]");
+    puts("       [-hash=<modulo|xor|prime|skew>] [-sethist=<0|1>]");
+    puts("       [-compress=<none|zero|bdi|fpc> [-tags=<tag entries per data way>] [-dlat=<decompression cycles>]] [-sector=<sector size(in Bytes)>]");
+    puts("       [-victim=<entries> [-vlat=<hit cycles>] [-vswap=<0|1>]] [-progress=<records between reports>]");
+    exit(1);
+}
+
 // check if argument is correctly passed to program
 void parseargv(int argc, char* argv[], int* cache_size, int* block_size, int* set_size, char** file_name) {
     char* ch = NULL;
+    char* value = NULL;
 
-    // check argument length
-    if (argc != 5) {
-        printf("Usage: %s -s=<cache size(in Bytes)> -a=<set size> -b=<block size(in Bytes)> -f=<trace file name>\n", argv[0]);
-        exit(1);
-    }
     // parse passed argument
     for (int i = 1; i < argc; i++) {
         ch = strtok(argv[i], "=-");
+        value = strtok(NULL, "\0");
+        if (ch && !strcmp(ch, "profile")) {
+            profile = TRUE;
+#ifndef CACHESIM_PROFILE
+            fputs("--profile ignored: rebuild with -DCACHESIM_PROFILE\n", stderr);
+#endif
+            continue;
+        }
+        if (ch == NULL || value == NULL)
+            usage(argv[0]);
+
         if (!strcmp(ch, "s"))
-            *cache_size = atoi(strtok(NULL, "\0"));
-        if (!strcmp(ch, "b"))
-            *block_size = atoi(strtok(NULL, "\0"));
-        if (!strcmp(ch, "a"))
-            *set_size = atoi(strtok(NULL, "\0"));
-        if (!strcmp(ch, "f"))
-            *file_name = strtok(NULL, "\0");
+            *cache_size = atoi(value);
+        else if (!strcmp(ch, "b"))
+            *block_size = atoi(value);
+        else if (!strcmp(ch, "a"))
+            *set_size = atoi(value);
+        else if (!strcmp(ch, "f"))
+            *file_name = value;
+        else if (!strcmp(ch, "m"))
+            shm_name = value;
+        else if (!strcmp(ch, "i"))
+            stats_interval = strtoull(value, NULL, 10);
+        else if (!strcmp(ch, "p") && !strcmp(value, "none"))
+            page_mode = PAGE_NORMAL;
+        else if (!strcmp(ch, "p") && !strcmp(value, "thp"))
+            page_mode = PAGE_THP;
+        else if (!strcmp(ch, "p") && !strcmp(value, "huge"))
+            page_mode = PAGE_HUGETLB;
+        else if (!strcmp(ch, "w"))
+            way_predict = atoi(value);
+        else if (!strcmp(ch, "e"))
+            openemit(value);
+        else if (!strcmp(ch, "d"))
+            drain_resident = atoi(value);
+        else if (!strcmp(ch, "o") && !strcmp(value, "text"))
+            output_mode = OUTPUT_TEXT;
+        else if (!strcmp(ch, "o") && !strcmp(value, "csv"))
+            output_mode = OUTPUT_CSV;
+        else if (!strcmp(ch, "n"))
+            record_limit = strtoull(value, NULL, 10);
+        else if (!strcmp(ch, "c"))
+            result_dir = value;
+        else if (!strcmp(ch, "F") && !strcmp(value, "sample"))
+            fingerprint_mode = FINGERPRINT_SAMPLE;
+        else if (!strcmp(ch, "F") && !strcmp(value, "full"))
+            fingerprint_mode = FINGERPRINT_FULL;
+        else if ((!strcmp(ch, "tlb1") || !strcmp(ch, "tlb2")) && strchr(value, ':')) {
+            TLB* t = &tlb[ch[3] - '1'];
+            t->entries = atoi(value);
+            t->ways = atoi(strchr(value, ':') + 1);
+            if (t->entries <= 0 || t->ways <= 0 || t->entries % t->ways)
+                usage(argv[0]);
+            if (ch[3] - '1' + 1 > tlb_levels)
+                tlb_levels = ch[3] - '1' + 1;
+        }
+        else if (!strcmp(ch, "pages")) {
+            page_mix[0] = page_mix[1] = page_mix[2] = 0;
+            for (char* tok = strtok(value, ","); tok; tok = strtok(NULL, ",")) {
+                if (!strncmp(tok, "4k:", 3))
+                    page_mix[0] = atoi(tok + 3);
+                else if (!strncmp(tok, "2m:", 3))
+                    page_mix[1] = atoi(tok + 3);
+                else if (!strncmp(tok, "1g:", 3))
+                    page_mix[2] = atoi(tok + 3);
+            }
+            if (page_mix[0] + page_mix[1] + page_mix[2] != 100)
+                usage(argv[0]);
+        }
+        else if (!strcmp(ch, "walk"))
+            walk_cycles = atoi(value);
+        else if (!strcmp(ch, "inject"))
+            inject_walk = atoi(value);
+        else if (!strcmp(ch, "map") && !strcmp(value, "identity"))
+            map_policy = MAP_IDENTITY;
+        else if (!strcmp(ch, "map") && !strcmp(value, "random"))
+            map_policy = MAP_RANDOM;
+        else if (!strcmp(ch, "map") && !strcmp(value, "color"))
+            map_policy = MAP_COLOR;
+        else if (!strcmp(ch, "hash") && !strcmp(value, "modulo"))
+            index_func = INDEX_MODULO;
+        else if (!strcmp(ch, "hash") && !strcmp(value, "xor"))
+            index_func = INDEX_XOR;
+        else if (!strcmp(ch, "hash") && !strcmp(value, "prime"))
+            index_func = INDEX_PRIME;
+        else if (!strcmp(ch, "hash") && !strcmp(value, "skew"))
+            index_func = INDEX_SKEW;
+        else if (!strcmp(ch, "sethist"))
+            set_hist = atoi(value);
+        else if (!strcmp(ch, "compress") && !strcmp(value, "none"))
+            compress_mode = COMPRESS_NONE;
+        else if (!strcmp(ch, "compress") && !strcmp(value, "zero"))
+            compress_mode = COMPRESS_ZERO;
+        else if (!strcmp(ch, "compress") && !strcmp(value, "bdi"))
+            compress_mode = COMPRESS_BDI;
+        else if (!strcmp(ch, "compress") && !strcmp(value, "fpc"))
+            compress_mode = COMPRESS_FPC;
+        else if (!strcmp(ch, "tags") && atoi(value) > 0)
+            tag_factor = atoi(value);
+        else if (!strcmp(ch, "dlat"))
+            decompress_latency = atoi(value);
+        else if (!strcmp(ch, "sector"))
+            sector_size = atoi(value);
+        else if (!strcmp(ch, "victim") && atoi(value) >= 0)
+            victim_entries = atoi(value);
+        else if (!strcmp(ch, "vlat"))
+            victim_latency = atoi(value);
+        else if (!strcmp(ch, "vswap"))
+            victim_swap = atoi(value);
+        else if (!strcmp(ch, "progress"))
+            progress_interval = strtoull(value, NULL, 10);
+        else
+            usage(argv[0]);
     }
+    // check mandatory arguments, exactly one trace source must be given
+    if (*cache_size <= 0 || *block_size <= 0 || *set_size <= 0 || (*file_name == NULL) == (shm_name == NULL))
+        usage(argv[0]);
+    // L2 TLB is only looked up behind L1 TLB
+    if (tlb_levels == 2 && tlb[0].entries == 0)
+        usage(argv[0]);
     // check cache size is big enough
     if ((*block_size * (*set_size)) > *cache_size) {
         puts("Cache size too small");
         exit(1);
     }
+    // compressed blocks of a set share its byte budget, so every way must map to same set
+    if (compress_mode != COMPRESS_NONE && index_func == INDEX_SKEW) {
+        puts("Compression needs a non-skewed set index function");
+        exit(1);
+    }
+    // sector is whole number of words, with one mask bit per sector
+    if (sector_size && (sector_size < 0 || sector_size % WORDSIZE || *block_size % sector_size || *block_size / sector_size > SECTOR_MAX)) {
+        printf("Sector size must be a multiple of %d Bytes dividing block size into at most %d sectors\n", WORDSIZE, SECTOR_MAX);
+        exit(1);
+    }
+    if (sector_size && compress_mode != COMPRESS_NONE) {
+        puts("Sectored blocks cannot be compressed");
+        exit(1);
+    }
+    // victim buffer holds whole uncompressed blocks
+    if (victim_entries && (sector_size || compress_mode != COMPRESS_NONE)) {
+        puts("Victim buffer cannot be combined with -sector or -compress");
+        exit(1);
+    }
+    if (decompress_latency < 0)
+        decompress_latency = (compress_mode == COMPRESS_FPC) ? CYCLE_DECOMPRESS_FPC : (compress_mode == COMPRESS_BDI) ? CYCLE_DECOMPRESS_BDI : 0;
 }
 
 // fetch WORD data from Memory
 MEMDATA* getMemdata(MEMORY* MEMptr, uint64_t addr) {
-    for (MEMDATA* cur = MEMptr->head; cur; cur = cur->next) {
-        if (cur->address == addr) {
-            return cur;
+    for (uint32_t i = MEMptr->bucket[mix64(addr) & (MEMptr->capacity - 1)]; i != MEM_NONE; i = MEMptr->entry[i].next) {
+        if (MEMptr->entry[i].address == addr) {
+            return &MEMptr->entry[i];
         }
     }
     return NULL;
@@ -131,6 +515,7 @@ MEMDATA* getMemdata(MEMORY* MEMptr, uint64_t addr) {
 // write WORD data to Memory
 void setMemdata(MEMORY* MEMptr, uint64_t addr, int data) {
     MEMDATA* mem = NULL;
+    uint32_t* bucket = NULL;
 
     // no need to add MEMDATA if address already exist -> only overwrite data
     mem = getMemdata(MEMptr, addr);
@@ -138,57 +523,86 @@ void setMemdata(MEMORY* MEMptr, uint64_t addr, int data) {
         mem->data = data;
         return;
     }
-    else {
-        mem = (MEMDATA*)malloc(sizeof(MEMDATA));
 
-        mem->data = data;
-        mem->address = addr;
-        mem->prev = NULL;
-        mem->next = NULL;
+    // append entry and put it at head of its bucket
+    if (MEMptr->count == MEMptr->capacity)
+        growmemory(MEMptr);
+    mem = &MEMptr->entry[MEMptr->count];
+    bucket = &MEMptr->bucket[mix64(addr) & (MEMptr->capacity - 1)];
+    mem->address = addr;
+    mem->data = data;
+    mem->next = *bucket;
+    *bucket = MEMptr->count++;
+}
 
-        // when data is added for the first time (no MEMDATA in MEMORY)
-        if (MEMptr->head == NULL && MEMptr->tail == NULL)
-            MEMptr->head = MEMptr->tail = mem;
-        else {
-            MEMDATA* cur = MEMptr->head;
-            while (cur->next) {
-                if (addr > cur->address && addr < cur->next->address) {
-                    // when data goes to tail
-                    if (cur->next == NULL)
-                        MEMptr->tail = mem;
-                    cur->next->prev = mem;
-                    mem->next = cur->next;
-                    cur->next = mem;
-                    mem->prev = cur;
-                    return;
-                }
-                cur = cur->next;
-            }
-            // when data goes to head
-            if (addr < cur->address) {
-                MEMptr->head->prev = mem;
-                mem->next = MEMptr->head;
-                MEMptr->head = mem;
-            }
-            // when data goes to tail
-            else {
-                MEMptr->tail->next = mem;
-                mem->prev = MEMptr->tail;
-                MEMptr->tail = mem;
+// double capacity of Memory and rehash every entry
+void growmemory(MEMORY* MEMptr) {
+    if (MEMptr->capacity >= MEM_MAX) {
+        printf("Memory image exceeds %" PRIu32 " words\n", MEM_MAX);
+        exit(1);
+    }
+    MEMptr->capacity *= 2;
+    MEMptr->entry = (MEMDATA*)realloc(MEMptr->entry, sizeof(MEMDATA) * MEMptr->capacity);
+    free(MEMptr->bucket);
+    MEMptr->bucket = (uint32_t*)malloc(sizeof(uint32_t) * MEMptr->capacity);
+    if (MEMptr->entry == NULL || MEMptr->bucket == NULL) {
+        puts("Out of memory for memory image");
+        exit(1);
+    }
 
-            }
-        }
+    memset(MEMptr->bucket, 0xFF, sizeof(uint32_t) * MEMptr->capacity); // MEM_NONE
+    for (uint32_t i = 0; i < MEMptr->count; i++) {
+        uint32_t* bucket = &MEMptr->bucket[mix64(MEMptr->entry[i].address) & (MEMptr->capacity - 1)];
+        MEMptr->entry[i].next = *bucket;
+        *bucket = i;
     }
 }
 
-// print all Memory
+// order MEMDATA by address (qsort)
+int compareaddress(const void* a, const void* b) {
+    uint64_t x = ((const MEMDATA*)a)->address, y = ((const MEMDATA*)b)->address;
+
+    return (x > y) - (x < y);
+}
+
+// print all Memory in address order
 void printMemory(MEMORY* MEMptr) {
+    MEMDATA* sorted = (MEMDATA*)malloc(sizeof(MEMDATA) * (MEMptr->count + 1));
     int cnt = 1;
-    for (MEMDATA* p = MEMptr->head; p; p = p->next, cnt++) {
-        printf("Address: %.20ld --> DATA: %ld\n", p->address, p->data);
+
+    memcpy(sorted, MEMptr->entry, sizeof(MEMDATA) * MEMptr->count);
+    qsort(sorted, MEMptr->count, sizeof(MEMDATA), compareaddress);
+    for (MEMDATA* p = sorted; p < sorted + MEMptr->count; p++, cnt++) {
+        printf("Address: %.20" PRIu64 " --> DATA: %d\n", p->address, p->data);
         if (cnt % word_count == 0)
             putchar('\n');
     }
+    free(sorted);
+}
+
+// allocate zero-filled arena with single mmap, backed by huge pages if requested
+void* allocarena(size_t size) {
+    void* p = MAP_FAILED;
+
+    if (page_mode == PAGE_HUGETLB) {
+        arena_size = ALIGN_UP(size, HUGEPAGE_SIZE);
+        p = mmap(NULL, arena_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p == MAP_FAILED)
+            fputs("MAP_HUGETLB unavailable, falling back to transparent huge pages\n", stderr);
+    }
+    if (p == MAP_FAILED) {
+        arena_size = (page_mode == PAGE_NORMAL) ? size : ALIGN_UP(size, HUGEPAGE_SIZE);
+        p = mmap(NULL, arena_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            perror("mmap");
+            exit(1);
+        }
+        if (page_mode != PAGE_NORMAL)
+            madvise(p, arena_size, MADV_HUGEPAGE);
+    }
+
+    arena = p;
+    return p;
 }
 
 // initalize and assign the cache structure
@@ -199,46 +613,84 @@ void initcache() {
 
     word_count = block_size / WORDSIZE; // block 안에 있는 WORD의 개수
     byte_offset = log_2(word_count) + log_2(WORDSIZE); // 1바이트 단위로 뛰기 위한 오프셋
+    sector_words = (sector_size ? sector_size : block_size) / WORDSIZE;
+    sector_count = word_count / sector_words;
 
     tag_bit = BIT_MAX - (index_bit + byte_offset);
 
+    // under compression each set holds tag_factor tag entries per block of data
+    data_ways = set_size;
+    set_budget = data_ways * block_size;
+    if (compress_mode != COMPRESS_NONE)
+        set_size *= tag_factor;
+
+    // compute address masks once instead of on every access
+    byte_mask = getmask(0, byte_offset);
+    index_mask = getmask(byte_offset, index_bit);
+    tag_mask = getmask(byte_offset + index_bit, tag_bit);
+    selectkernel();
+
+    // largest prime <= set count for INDEX_PRIME
+    for (index_prime = index_total; index_prime > 2; index_prime--) {
+        int isprime = TRUE;
+        for (int d = 2; d * d <= index_prime && isprime; d++)
+            isprime = (index_prime % d != 0);
+        if (isprime)
+            break;
+    }
+
+    // carve SET list, BLOCK list and block data out of one zero-filled arena
+    // layout: [SET x index_total][BLOCK x index_total*set_size][int x word_count per block][uint64_t x 2 per set]
+    size_t set_bytes = ALIGN_UP(sizeof(SET) * index_total, ARENA_ALIGN);
+    size_t block_bytes = ALIGN_UP(sizeof(BLOCK) * index_total * set_size, ARENA_ALIGN);
+    size_t data_bytes = ALIGN_UP(sizeof(int) * word_count * index_total * set_size, ARENA_ALIGN);
+    size_t hist_bytes = ALIGN_UP(sizeof(uint64_t) * 2 * index_total, ARENA_ALIGN);
+    char* cur = (char*)allocarena(set_bytes + block_bytes + data_bytes + hist_bytes);
+    BLOCK* blocks = (BLOCK*)(cur + set_bytes);
+    int* data = (int*)(cur + set_bytes + block_bytes);
+
+    set_access_count = (uint64_t*)(cur + set_bytes + block_bytes + data_bytes);
+    set_conflict_count = set_access_count + index_total;
+
     // assign the list of set, which will be entire cache
-    cache = (SET*)malloc(sizeof(SET) * index_total);
+    cache = (SET*)cur;
     for (int i = 0; i < index_total; i++) { // for each set in cache
-        cache[i].block = (BLOCK*)malloc(sizeof(BLOCK) * set_size);
-
-        for (int j = 0; j < set_size; j++) { // for each block in set
-            cache[i].block[j].tag = 0;
-            cache[i].block[j].valid = 0;
-            cache[i].block[j].dirty = 0;
-            cache[i].block[j].data = (int*)malloc(sizeof(int) * word_count);
+        cache[i].block = blocks + (size_t)i * set_size;
 
-            for (int k = 0; k < word_count; k++) // for each WORD in block
-                cache[i].block[j].data[k] = 0;
-        }
+        for (int j = 0; j < set_size; j++) // for each block in set
+            cache[i].block[j].data = data + ((size_t)i * set_size + j) * word_count;
     }
 
-    // Initalize MEMORY (Linked List)
+    // uncompressed baseline only keeps tags
+    if (compress_mode != COMPRESS_NONE)
+        shadow = (BLOCK*)calloc((size_t)index_total * data_ways, sizeof(BLOCK));
+
+    // Initalize MEMORY (hash table of written words)
     MEMptr = (MEMORY*)malloc(sizeof(MEMORY));
-    MEMptr->head = NULL;
-    MEMptr->tail = NULL;
+    MEMptr->count = 0;
+    MEMptr->capacity = MEM_INITIAL;
+    MEMptr->entry = (MEMDATA*)malloc(sizeof(MEMDATA) * MEM_INITIAL);
+    MEMptr->bucket = (uint32_t*)malloc(sizeof(uint32_t) * MEM_INITIAL);
+    memset(MEMptr->bucket, 0xFF, sizeof(uint32_t) * MEM_INITIAL); // MEM_NONE
 }
 
 // construct proper address structure
 void set_address(ADDRESS* addr, uint64_t address_int) {
-    int64_t mask = 0;
-
     // set byte offset
-    mask = getmask(0, byte_offset);
-    addr->byte = address_int & mask;
+    addr->byte = address_int & byte_mask;
 
-    // set index bit
-    mask = getmask(byte_offset, index_bit);
-    addr->index = (address_int & mask) >> (byte_offset);
+    if (index_func == INDEX_MODULO) {
+        // set index bit
+        addr->index = (address_int & index_mask) >> (byte_offset);
 
-    // set tag bit
-    mask = getmask(byte_offset + index_bit, tag_bit);
-    addr->tag = (address_int & mask) >> (byte_offset + index_bit);
+        // set tag bit
+        addr->tag = (address_int & tag_mask) >> (byte_offset + index_bit);
+    }
+    else {
+        // hashed index doesn't determine any address bits, so whole block number is kept as tag
+        addr->tag = address_int >> byte_offset;
+        addr->index = setindex(addr->tag, 0);
+    }
 
     // set block offset
     addr->block = addr->byte / WORDSIZE;
@@ -246,20 +698,67 @@ void set_address(ADDRESS* addr, uint64_t address_int) {
 
 // return mask generated from start bit index and bit count from that bit
 uint64_t getmask(int start, int cnt) {
-    int64_t upper_bit = (start + cnt >= BIT_MAX ? -1 : (1 << (start + cnt)) - 1);
-    int64_t lower_bit = ((1 << start) - 1);
+    uint64_t upper_bit = (start + cnt >= BIT_MAX ? (uint64_t)-1 : ((uint64_t)1 << (start + cnt)) - 1);
+    uint64_t lower_bit = (((uint64_t)1 << start) - 1);
 
     return upper_bit - lower_bit;
 }
 
+// return start address of block from its tag and set index
+uint64_t blocktoint(uint64_t tag, uint64_t index) {
+    if (index_func != INDEX_MODULO)
+        return tag << byte_offset; // tag is whole block number
+    return (tag << (index_bit + byte_offset)) + (index << byte_offset);
+}
+
+// return set index of block number in given way under index_func
+uint64_t setindex(uint64_t blockno, int way) {
+    uint64_t index = 0;
+
+    switch (index_func) {
+        case INDEX_XOR:
+            if (index_bit == 0)
+                return 0;
+            for (; blockno; blockno >>= index_bit)
+                index ^= blockno;
+            return index & (index_total - 1);
+        case INDEX_PRIME:
+            return blockno % index_prime;
+        case INDEX_SKEW:
+            // low bits xor way-specific hash of bits above them
+            return (blockno ^ mix64((blockno >> index_bit) ^ ((uint64_t)way << 58))) & (index_total - 1);
+        default:
+            return blockno & (index_total - 1);
+    }
+}
+
+// return set holding given way of addr (differs per way only under skewed indexing)
+uint64_t wayset(ADDRESS addr, int way) {
+    return index_func == INDEX_SKEW ? setindex(addr.tag, way) : addr.index;
+}
+
+// return block of given way that addr may occupy
+BLOCK* blockat(ADDRESS addr, int way) {
+    return &cache[wayset(addr, way)].block[way];
+}
+
 // check if cache already contains address --> HIT!
 int isHit(ADDRESS addr, int* resultidx) {
     BLOCK current_block;
 
     total_cycle += CYCLE_CACHE_HIT; // increment total memory access cycle
     for (int i = 0; i < set_size; i++) {
-        current_block = cache[addr.index].block[i];
+        current_block = *blockat(addr, i);
         if (current_block.valid && (current_block.tag == addr.tag)) {
+            // block is present, but not sector holding addr -> fetchblock only fetches sector
+            if (!(current_block.sector_valid >> (addr.block / sector_words) & 1)) {
+                if (verbose)
+                    printf("Sector miss - ");
+                sector_miss_count++;
+                miss_count++;
+                *resultidx = i;
+                return FALSE;
+            }
             if (verbose)
                 printf("Hit! - ");
             hit_count++;
@@ -273,50 +772,172 @@ int isHit(ADDRESS addr, int* resultidx) {
     return FALSE;
 }
 
+// specialized set_address for block size BSIZE(= 2^BOFFSET Bytes)
+// byte offset is compile-time constant, so its shift and mask are folded
+#define DEFINE_SET_ADDRESS_KERNEL(BSIZE, BOFFSET) \
+void set_address_b##BSIZE(ADDRESS* addr, uint64_t address_int) { \
+    addr->byte = address_int & (((uint64_t)1 << BOFFSET) - 1); \
+    addr->index = (address_int >> BOFFSET) & (index_mask >> BOFFSET); \
+    addr->tag = address_int >> (BOFFSET + index_bit); \
+    addr->block = addr->byte / WORDSIZE; \
+}
+
+// specialized isHit for set size ASSOC, way loop is fully unrolled
+#define DEFINE_ISHIT_KERNEL(ASSOC) \
+int isHit_a##ASSOC(ADDRESS addr, int* resultidx) { \
+    BLOCK* set = cache[addr.index].block; \
+\
+    total_cycle += CYCLE_CACHE_HIT; \
+    _Pragma("GCC unroll 16") \
+    for (int i = 0; i < ASSOC; i++) { \
+        if (set[i].valid && (set[i].tag == addr.tag)) { \
+            if (verbose) \
+                printf("Hit! - "); \
+            hit_count++; \
+            *resultidx = i; \
+            return TRUE; \
+        } \
+    } \
+    if (verbose) \
+        printf("Miss - "); \
+    miss_count++; \
+    return FALSE; \
+}
+
+DEFINE_SET_ADDRESS_KERNEL(64, 6)
+DEFINE_SET_ADDRESS_KERNEL(128, 7)
+DEFINE_SET_ADDRESS_KERNEL(256, 8)
+
+DEFINE_ISHIT_KERNEL(1)
+DEFINE_ISHIT_KERNEL(2)
+DEFINE_ISHIT_KERNEL(4)
+DEFINE_ISHIT_KERNEL(8)
+DEFINE_ISHIT_KERNEL(16)
+
+// pick specialized kernels matching cache geometry, generic ones otherwise
+void selectkernel() {
+    switch (index_func == INDEX_MODULO ? block_size : 0) {
+        case 64: set_address_kernel = set_address_b64; break;
+        case 128: set_address_kernel = set_address_b128; break;
+        case 256: set_address_kernel = set_address_b256; break;
+        default: set_address_kernel = set_address; break;
+    }
+    // specialized kernels only compare tags, so sectored blocks need generic isHit
+    switch ((index_func == INDEX_SKEW || sector_count > 1) ? 0 : set_size) {
+        case 1: isHit_kernel = isHit_a1; break;
+        case 2: isHit_kernel = isHit_a2; break;
+        case 4: isHit_kernel = isHit_a4; break;
+        case 8: isHit_kernel = isHit_a8; break;
+        case 16: isHit_kernel = isHit_a16; break;
+        default: isHit_kernel = isHit; break;
+    }
+    // put way prediction in front of selected tag search
+    if (way_predict) {
+        tagsearch_kernel = isHit_kernel;
+        isHit_kernel = isHit_predicted;
+    }
+}
+
+// check same-block filter and MRU way before full tag search
+// tags in a set are unique, so result is identical to isHit
+int isHit_predicted(ADDRESS addr, int* resultidx) {
+    BLOCK* mru = NULL;
+    int way = -1;
+
+    if (last_way >= 0 && last_index == addr.index && last_tag == addr.tag && (blockat(addr, last_way)->sector_valid >> (addr.block / sector_words) & 1)) {
+        // same block as previous record
+        filter_hit_count++;
+        way = last_way;
+    }
+    else {
+        way = cache[addr.index].mru;
+        mru = blockat(addr, way);
+        if (mru->valid && (mru->tag == addr.tag) && (mru->sector_valid >> (addr.block / sector_words) & 1)) {
+            predict_count++;
+            predict_hit_count++;
+        }
+        else if (tagsearch_kernel(addr, resultidx)) {
+            // mispredicted hit (tag search already counted hit and cycle)
+            predict_count++;
+            cache[addr.index].mru = last_way = *resultidx;
+            last_index = addr.index;
+            last_tag = addr.tag;
+            return TRUE;
+        }
+        else {
+            // miss -> fetchblock sets mru and filter to filled way
+            return FALSE;
+        }
+    }
+
+    total_cycle += CYCLE_CACHE_HIT; // increment total memory access cycle
+    if (verbose)
+        printf("Hit! - ");
+    hit_count++;
+    *resultidx = way;
+    cache[addr.index].mru = last_way = way;
+    last_index = addr.index;
+    last_tag = addr.tag;
+    return TRUE;
+}
+
 // fetch block from memory and return index of block in SET
-int fetchblock(ADDRESS addr, int blockidx) {
+// blockidx >= 0 means block is already in that way, but without sector of addr (sectored cache)
+int fetchblock(ADDRESS addr, int blockidx, int isstore) {
     int victimidx = 0; // index of the First-In block in SET (Using FIFO replacement policy)
     MEMDATA* block_on_memory = NULL; // start address of block on memory includes addr
     ADDRESS blockaddr; // start address of block on memory includes addr
     uint64_t blockaddr_to_int = 0;
-    uint64_t lrublockaddr_to_int = 0;
     int isemptyblock = FALSE;
+    int sectormiss = (blockidx >= 0);
+    int sectoridx = addr.block / sector_words; // sector of block holding addr
+    int ventry = -1, vdirty = FALSE; // victim buffer entry holding block
+    BLOCK* blk = NULL;
 
-    // When cache miss occur, there are two cases
+    // When cache miss occur, there are three cases
     // 1. Empty block(valid: 0) exists in SET -> find index of that block and write data
     // 2. All blocks in SET are full -> find First-In block and write that block to memory. Then, write data to block(in cache)
+    // 3. Block is present but its sector is not -> only fetch sector
 
     // iterate BLOCK in SET to get proper block address
-    for (blockidx = 0, victimidx = 0; blockidx < set_size; blockidx++) {
+    for (blockidx = sectormiss ? blockidx : 0, victimidx = 0; !sectormiss && blockidx < set_size; blockidx++) {
         // block++ until it finds empty block
-        if (cache[addr.index].block[blockidx].valid == 0) {
+        if (blockat(addr, blockidx)->valid == 0) {
             isemptyblock = TRUE;
             break;
         }
         // check brought-in time(block->fetched_time) and update victimidx so that we can get the index of First-In block
-        else if (cache[addr.index].block[blockidx].fetched_time < cache[addr.index].block[victimidx].fetched_time) {
+        else if (blockat(addr, blockidx)->fetched_time < blockat(addr, victimidx)->fetched_time) {
             victimidx = blockidx;
         }
     }
 
 
-    // Case #2. write First-In block to Memory and set blockidx to victimidx if SET is full
-    if (isemptyblock == FALSE) {
-        // calculate start address of LRU block
-        lrublockaddr_to_int = (cache[addr.index].block[victimidx].tag) << (index_bit + byte_offset);
-        lrublockaddr_to_int += (addr.index << byte_offset);
+    // take block out of victim buffer before evicted block is put in (swap)
+    if (!sectormiss && victim_entries && victim_swap && (ventry = victimhit(addr)) >= 0) {
+        memcpy(victim_scratch, victim_buffer[ventry].data, sizeof(int) * word_count);
+        vdirty = victim_buffer[ventry].dirty;
+        victimunlink(ventry);
+    }
 
-        // when First-In block is dirty, write data of block to memory
-        if (cache[addr.index].block[victimidx].dirty) {
-            for (int i = 0; i < word_count; i++) {
-                setMemdata(MEMptr, lrublockaddr_to_int + (WORDSIZE * i), cache[addr.index].block[victimidx].data[i]);
-            }
-            total_cycle += CYCLE_MEM_ACC; // increment total memory access cycle
-            mem_acc_count++;
-        }
+    // Case #2. write First-In block to Memory and set blockidx to victimidx if SET is full
+    if (!sectormiss && isemptyblock == FALSE) {
+        evictblock(addr, victimidx);
         // set blockidx to victimidx 
         blockidx = victimidx;
     }
+    blk = blockat(addr, blockidx);
+    if (!sectormiss) {
+        blk->dirty = 0; // dirty bit = 0 since only fetched block from memory
+        blk->sector_valid = blk->sector_dirty = 0;
+    }
+
+    // keep way prediction coherent: predict filled block next (evictblock already forgot evicted one)
+    if (way_predict) {
+        cache[addr.index].mru = last_way = blockidx;
+        last_index = addr.index;
+        last_tag = addr.tag;
+    }
 
 
     // set address information(start address of block) to blockaddr
@@ -325,63 +946,461 @@ int fetchblock(ADDRESS addr, int blockidx) {
     blockaddr.block = blockaddr.byte = 0;
 
     // convert struct ADDRESS to int
-    blockaddr_to_int += (blockaddr.tag << (index_bit + byte_offset));
-    blockaddr_to_int += (blockaddr.index << byte_offset);
+    blockaddr_to_int = blocktoint(blockaddr.tag, blockaddr.index);
+
+    // copy Memory sector to cache (using Write-Allocate policy when STORE operation performed)
+    // STORE overwrites whole single-word sector, so it is allocated without reading memory
+    blk->sector_valid |= (uint64_t)1 << sectoridx;
+    if (ventry >= 0) {
+        // swapped in from victim buffer, no memory access
+        memcpy(blk->data, victim_scratch, sizeof(int) * word_count);
+        blk->dirty = vdirty;
+        blk->sector_dirty = vdirty;
+    }
+    else if (!(isstore && sector_size && sector_words == 1)) {
+        if (emit_fp)
+            emitrecord(MISS_FILL, blockaddr_to_int + (uint64_t)sectoridx * sector_words * WORDSIZE);
+        PROF_BEGIN(PROF_MEMORY);
+        for (int i = sectoridx * sector_words; i < (sectoridx + 1) * sector_words; i++) {
+            block_on_memory = getMemdata(MEMptr, blockaddr_to_int + (WORDSIZE * i));
+            blk->data[i] = block_on_memory ? block_on_memory->data : 0;
+        }
+        PROF_END(PROF_MEMORY);
+        memtransfer(sector_words * WORDSIZE, FALSE);
+    }
 
-    // copy Memory block to cache (using Write-Allocate policy when STORE operation performed)
-    for (int i = 0; i < word_count; i++) {
-        block_on_memory = getMemdata(MEMptr, blockaddr_to_int + (WORDSIZE * i));
-        cache[addr.index].block[blockidx].data[i] = block_on_memory ? block_on_memory->data : 0;
+    // account filled block, compressed block may need more room than evicted one
+    if (!sectormiss) {
+        blk->size = compress_mode ? compressedsize(blk->data) : block_size;
+        valid_blocks++;
+        stored_bytes += blk->size;
+        if (compress_mode)
+            makeroom(addr, blockidx);
     }
-    total_cycle += CYCLE_MEM_ACC; // increment total memory access cycle
-    mem_acc_count++;
 
     // return blockidx to use later
     return blockidx;
 }
 
+// allocate victim buffer entries, their block data and hash table (after initcache)
+void initvictim() {
+    if (victim_entries == 0)
+        return;
+
+    // at least two buckets per entry keeps chains short
+    for (victim_buckets = 1; victim_buckets < 2 * victim_entries; victim_buckets <<= 1);
+    victim_buffer = (VICTIM*)calloc(victim_entries, sizeof(VICTIM));
+    victim_bucket = (int*)malloc(sizeof(int) * victim_buckets);
+    victim_scratch = (int*)calloc((size_t)word_count * (victim_entries + 1), sizeof(int));
+    for (int i = 0; i < victim_buckets; i++)
+        victim_bucket[i] = -1;
+
+    // every entry starts on free list
+    for (int i = 0; i < victim_entries; i++) {
+        victim_buffer[i].data = victim_scratch + (size_t)(i + 1) * word_count;
+        victim_buffer[i].next = (i + 1 < victim_entries) ? i + 1 : -1;
+    }
+    victim_free = 0;
+}
+
+// look up block of addr in victim buffer, return its entry or -1
+int victimhit(ADDRESS addr) {
+    uint64_t blockaddr = blocktoint(addr.tag, addr.index);
+
+    for (int e = victim_bucket[mix64(blockaddr) & (victim_buckets - 1)]; e >= 0; e = victim_buffer[e].hnext) {
+        if (victim_buffer[e].blockaddr == blockaddr) {
+            victim_hit_count++;
+            total_cycle += victim_latency;
+            return e;
+        }
+    }
+    return -1;
+}
+
+// remove entry from LRU list and hash table, and put it on free list
+void victimunlink(int e) {
+    VICTIM* v = &victim_buffer[e];
+    int* link = &victim_bucket[mix64(v->blockaddr) & (victim_buckets - 1)];
+
+    while (*link != e)
+        link = &victim_buffer[*link].hnext;
+    *link = v->hnext;
+
+    if (v->prev >= 0)
+        victim_buffer[v->prev].next = v->next;
+    else
+        victim_mru = v->next;
+    if (v->next >= 0)
+        victim_buffer[v->next].prev = v->prev;
+    else
+        victim_lru = v->prev;
+
+    v->next = victim_free;
+    victim_free = e;
+}
+
+// link entry at MRU end of LRU list
+void victimlinkmru(int e) {
+    victim_buffer[e].prev = -1;
+    victim_buffer[e].next = victim_mru;
+    if (victim_mru >= 0)
+        victim_buffer[victim_mru].prev = e;
+    else
+        victim_lru = e;
+    victim_mru = e;
+}
+
+// move entry to MRU end of LRU list
+void victimtouch(int e) {
+    VICTIM* v = &victim_buffer[e];
+
+    if (e == victim_mru)
+        return;
+    victim_buffer[v->prev].next = v->next;
+    if (v->next >= 0)
+        victim_buffer[v->next].prev = v->prev;
+    else
+        victim_lru = v->prev;
+    victimlinkmru(e);
+}
+
+// put block evicted from main cache in victim buffer, writing back LRU entry when full
+void victiminsert(uint64_t blockaddr, int* data, int dirty) {
+    VICTIM* v = NULL;
+    int e = -1;
+    int* link = NULL;
+
+    if (victim_free < 0) {
+        e = victim_lru;
+        if (victim_buffer[e].dirty) {
+            writeback(victim_buffer[e].blockaddr, victim_buffer[e].data, 1);
+            victim_writeback_count++;
+        }
+        victimunlink(e);
+    }
+    e = victim_free;
+    v = &victim_buffer[e];
+    victim_free = v->next;
+
+    v->blockaddr = blockaddr;
+    v->dirty = dirty;
+    memcpy(v->data, data, sizeof(int) * word_count);
+    link = &victim_bucket[mix64(blockaddr) & (victim_buckets - 1)];
+    v->hnext = *link;
+    *link = e;
+    victimlinkmru(e);
+}
+
+// charge memory access moving given Bytes, cycles scale with share of block moved
+void memtransfer(int bytes, int iswrite) {
+    total_cycle += (CYCLE_MEM_ACC * bytes + block_size - 1) / block_size; // increment total memory access cycle
+    mem_acc_count++;
+    if (iswrite)
+        mem_write_bytes += bytes;
+    else
+        mem_read_bytes += bytes;
+}
+
+// write dirty sectors of block starting at blockaddr to memory in one access
+void writeback(uint64_t blockaddr, int* data, uint64_t dirtymask) {
+    int sectors = 0;
+
+    PROF_BEGIN(PROF_MEMORY);
+    for (int j = 0; j < sector_count; j++) {
+        if (!(dirtymask >> j & 1))
+            continue;
+        for (int i = j * sector_words; i < (j + 1) * sector_words; i++) {
+            setMemdata(MEMptr, blockaddr + (WORDSIZE * i), data[i]);
+        }
+        if (emit_fp)
+            emitrecord(MISS_WRITEBACK, blockaddr + (uint64_t)j * sector_words * WORDSIZE);
+        sectors++;
+    }
+    PROF_END(PROF_MEMORY);
+    memtransfer(sectors * sector_words * WORDSIZE, TRUE);
+}
+
+// evict block in given way of addr's set, write it back to memory when dirty
+void evictblock(ADDRESS addr, int way) {
+    BLOCK* victim = blockat(addr, way);
+    uint64_t victimaddr_to_int = blocktoint(victim->tag, addr.index); // start address of evicted block
+
+    set_conflict_count[wayset(addr, way)]++;
+
+    // evicted block goes to victim buffer, or straight to memory when dirty
+    if (victim_entries)
+        victiminsert(victimaddr_to_int, victim->data, victim->dirty);
+    else if (victim->dirty)
+        writeback(victimaddr_to_int, victim->data, victim->sector_dirty);
+
+    // forget evicted block in same-block filter
+    if (last_way == way && last_index == addr.index)
+        last_way = -1;
+    valid_blocks--;
+    stored_bytes -= victim->size;
+    victim->valid = 0;
+    victim->dirty = 0;
+    victim->sector_valid = victim->sector_dirty = 0;
+}
+
+// return size in bits of data under base-delta-immediate (zero base plus one explicit base)
+int bdibits(int* data) {
+    int best = word_count * 32, fits = TRUE, bits = 0;
+    int64_t base = 0, delta = 0;
+
+    // all-zero and repeated-value blocks
+    for (int i = 1; i < word_count && fits; i++)
+        fits = (data[i] == data[0]);
+    if (fits)
+        return data[0] ? 32 : 8;
+
+    // 1 and 2 Byte deltas, each word is delta from zero or from first word which is not
+    for (int dbytes = 1; dbytes <= 2; dbytes++) {
+        int64_t limit = (int64_t)1 << (8 * dbytes - 1);
+        int hasbase = FALSE;
+
+        fits = TRUE;
+        for (int i = 0; i < word_count && fits; i++) {
+            if (data[i] >= -limit && data[i] < limit)
+                continue;
+            if (!hasbase) {
+                base = data[i];
+                hasbase = TRUE;
+            }
+            delta = (int64_t)data[i] - base;
+            fits = (delta >= -limit && delta < limit);
+        }
+        // base, deltas and 1-Bit base selector per word
+        bits = 32 + word_count * (8 * dbytes + 1);
+        if (fits && bits < best)
+            best = bits;
+    }
+    return best;
+}
+
+// return size in bits of data under frequent pattern compression (3-Bit prefix per word)
+int fpcbits(int* data) {
+    int bits = 0, zero_run = 0;
+
+    for (int i = 0; i < word_count; i++) {
+        int32_t w = data[i];
+        uint32_t u = (uint32_t)w;
+
+        // run of up to 8 zero words shares one prefix and 3-Bit run length
+        if (w == 0) {
+            if (zero_run++ % 8 == 0)
+                bits += 3 + 3;
+            continue;
+        }
+        zero_run = 0;
+        if (w >= -8 && w < 8)
+            bits += 3 + 4; // 4-Bit sign-extended
+        else if (w >= -128 && w < 128)
+            bits += 3 + 8; // 1 Byte sign-extended
+        else if (w >= -32768 && w < 32768)
+            bits += 3 + 16; // halfword sign-extended
+        else if ((u & 0xFFFF) == 0)
+            bits += 3 + 16; // halfword padded with zero halfword
+        else if ((int8_t)(u & 0xFF) == (int16_t)(u & 0xFFFF) && (int8_t)(u >> 16) == (int16_t)(u >> 16))
+            bits += 3 + 16; // two halfwords, each a sign-extended Byte
+        else if (u == (u & 0xFF) * 0x01010101u)
+            bits += 3 + 8; // repeated Bytes
+        else
+            bits += 3 + 32; // uncompressed
+    }
+    return bits;
+}
+
+// return stored size of block data in Bytes
+// each data word stands for WORDSIZE Bytes, so compressibility of words is scaled to block size
+int compressedsize(int* data) {
+    int bits = word_count * 32, size = 0;
+
+    switch (compress_mode) {
+        case COMPRESS_ZERO:
+            bits = 0;
+            for (int i = 0; i < word_count; i++) {
+                if (data[i]) {
+                    bits = word_count * 32;
+                    break;
+                }
+            }
+            break;
+        case COMPRESS_BDI:
+            bits = bdibits(data);
+            break;
+        case COMPRESS_FPC:
+            bits = fpcbits(data);
+            break;
+    }
+    size = ALIGN_UP((int)(((int64_t)bits * block_size + word_count * 32 - 1) / (word_count * 32)), COMPRESS_SEGMENT);
+    return size < block_size ? size : block_size;
+}
+
+// evict oldest blocks of addr's set until its blocks fit in set_budget, keeping block in way keep
+void makeroom(ADDRESS addr, int keep) {
+    BLOCK* set = cache[addr.index].block;
+    int bytes = 0, victimidx = -1;
+
+    while (TRUE) {
+        bytes = 0;
+        victimidx = -1;
+        for (int i = 0; i < set_size; i++) {
+            if (i == keep)
+                bytes += set[i].size; // may not be valid yet while being filled
+            else if (set[i].valid) {
+                bytes += set[i].size;
+                if (victimidx < 0 || set[i].fetched_time < set[victimidx].fetched_time)
+                    victimidx = i;
+            }
+        }
+        if (bytes <= set_budget)
+            return;
+        evictblock(addr, victimidx);
+        compress_evict_count++;
+    }
+}
+
+// access uncompressed tag-only copy of cache, same FIFO policy as fetchblock
+void shadowaccess(ADDRESS addr, int isstore) {
+    BLOCK* set = shadow + addr.index * data_ways;
+    int victimidx = 0;
+
+    for (int i = 0; i < data_ways; i++) {
+        if (set[i].valid && set[i].tag == addr.tag) {
+            set[i].dirty |= isstore;
+            return;
+        }
+    }
+    shadow_miss_count++;
+    for (int i = 0; i < data_ways; i++) {
+        if (set[i].valid == 0) {
+            victimidx = i;
+            break;
+        }
+        else if (set[i].fetched_time < set[victimidx].fetched_time)
+            victimidx = i;
+    }
+    if (set[victimidx].valid && set[victimidx].dirty)
+        shadow_mem_acc_count++; // writeback
+    shadow_mem_acc_count++;
+    set[victimidx].tag = addr.tag;
+    set[victimidx].valid = 1;
+    set[victimidx].dirty = isstore;
+    if (isstore)
+        set[victimidx].fetched_time = shadow_timecnt++;
+}
+
 // perform STORE operation
 void write_to_cache(ADDRESS addr, int data) {
     int blockidx = -1; // index of the block that we write data
+    int hit = FALSE, sectormiss = FALSE;
+    int ventry = -1; // victim buffer entry
+    BLOCK* blk = NULL;
+
+    set_access_count[addr.index]++;
+    if (compress_mode) {
+        shadowaccess(addr, TRUE);
+        valid_block_sum += valid_blocks;
+        stored_byte_sum += stored_bytes;
+    }
 
     // directly write to cache when HIT
     // fetch block from Memory when MISS
-    if (!isHit(addr, &blockidx)) {
-        blockidx = fetchblock(addr, blockidx);
-
-        cache[addr.index].block[blockidx].tag = addr.tag;
-        cache[addr.index].block[blockidx].fetched_time = timecnt++; // update fetched-time for FIFO implementation
+    PROF_BEGIN(PROF_LOOKUP);
+    hit = isHit_kernel(addr, &blockidx);
+    PROF_END(PROF_LOOKUP);
+    // victim buffer hit without swap is served by buffer, main cache is left as is
+    if (!hit && victim_entries && !victim_swap && (ventry = victimhit(addr)) >= 0) {
+        victimtouch(ventry);
+        victim_buffer[ventry].dirty = 1;
+        victim_buffer[ventry].data[addr.block] = data;
+        return;
+    }
+    if (!hit) {
+        // blockidx is set when only sector of block is missing
+        sectormiss = (blockidx >= 0);
+        PROF_BEGIN(PROF_MISS);
+        blockidx = fetchblock(addr, blockidx, TRUE);
+        PROF_END(PROF_MISS);
+
+        blk = blockat(addr, blockidx);
+        if (!sectormiss) {
+            blk->tag = addr.tag;
+            blk->fetched_time = timecnt++; // update fetched-time for FIFO implementation
+        }
+    }
+    blk = blockat(addr, blockidx);
+    if (compress_mode && hit && blk->size < block_size) {
+        total_cycle += decompress_latency;
+        decompress_count++;
     }
 
     // write new data(passed to argument) to cache
-    cache[addr.index].block[blockidx].dirty = 1;
-    cache[addr.index].block[blockidx].valid = 1;
-    cache[addr.index].block[blockidx].data[addr.block] = data;
+    blk->dirty = 1;
+    blk->valid = 1;
+    blk->sector_dirty |= (uint64_t)1 << (addr.block / sector_words);
+    blk->data[addr.block] = data;
+
+    // recompress block, it may not fit in its set anymore
+    if (compress_mode) {
+        stored_bytes -= blk->size;
+        blk->size = compressedsize(blk->data);
+        stored_bytes += blk->size;
+        makeroom(addr, blockidx);
+    }
 }
 
 // perform LOAD operation
 int read_from_cache(ADDRESS addr) {
     int blockidx = -1; // index of the block that we write data
+    int hit = FALSE, sectormiss = FALSE;
+    int ventry = -1; // victim buffer entry
+    BLOCK* blk = NULL;
+
+    set_access_count[addr.index]++;
+    if (compress_mode) {
+        shadowaccess(addr, FALSE);
+        valid_block_sum += valid_blocks;
+        stored_byte_sum += stored_bytes;
+    }
 
     // directly return data from cache when HIT
     // fetch block from Memory when MISS
-    if (!isHit(addr, &blockidx)) {
-        // fetch block from Memory when MISS
-        blockidx = fetchblock(addr, blockidx);
-
-        cache[addr.index].block[blockidx].dirty = 0; // dirty bit = 0 since only fetched block from memory
-        cache[addr.index].block[blockidx].valid = 1;
-        cache[addr.index].block[blockidx].tag = addr.tag;
+    PROF_BEGIN(PROF_LOOKUP);
+    hit = isHit_kernel(addr, &blockidx);
+    PROF_END(PROF_LOOKUP);
+    // victim buffer hit without swap is served by buffer, main cache is left as is
+    if (!hit && victim_entries && !victim_swap && (ventry = victimhit(addr)) >= 0) {
+        victimtouch(ventry);
+        return victim_buffer[ventry].data[addr.block];
+    }
+    if (!hit) {
+        // fetch block from Memory when MISS, blockidx is set when only sector of block is missing
+        sectormiss = (blockidx >= 0);
+        PROF_BEGIN(PROF_MISS);
+        blockidx = fetchblock(addr, blockidx, FALSE);
+        PROF_END(PROF_MISS);
+
+        blk = blockat(addr, blockidx);
+        if (!sectormiss) {
+            blk->valid = 1;
+            blk->tag = addr.tag;
+        }
+    }
+    blk = blockat(addr, blockidx);
+    if (compress_mode && hit && blk->size < block_size) {
+        total_cycle += decompress_latency;
+        decompress_count++;
     }
 
-    return cache[addr.index].block[blockidx].data[addr.block];
+    return blk->data[addr.block];
 }
 
 // prints simulation result
 void printresult(int printvalue) {
-    double miss_rate = 0, hit_rate = 0, average_cycle = 0, inst_per_cycle = 0;
     int dirty_count = 0;
-    
+
     for (int i = 0; i < index_total; i++) {
         printf("%d: ", i);
         for (int j = 0; j < set_size; j++) {
@@ -389,6 +1408,11 @@ void printresult(int printvalue) {
                 printf("   ");
 
             for (int k = 0; k < word_count; k++) {
+                // words of sectors never fetched hold no data
+                if (sector_size && !(cache[i].block[j].sector_valid >> (k / sector_words) & 1)) {
+                    printf("-------- ");
+                    continue;
+                }
                 printf("%.8X ", cache[i].block[j].data[k]);
                 if (verbose)
                     printf("(%5d)\t", cache[i].block[j].data[k]);
@@ -400,118 +1424,835 @@ void printresult(int printvalue) {
         }
     }
 
+    if (printvalue)
+        printstats();
+}
+
+// prints cache access statistics
+void printstats() {
+    double miss_rate = 0, hit_rate = 0, average_cycle = 0, inst_per_cycle = 0;
+
     hit_rate = 100.0 * hit_count / (hit_count + miss_count);
     miss_rate = 100.0 * miss_count / (hit_count + miss_count);
     average_cycle = (double)total_cycle / (hit_count + miss_count);
     inst_per_cycle = (double)insCnt / (double)total_cycle;
 
-    if (printvalue) {
-        puts("");
-        printf("# of L1 cache accesses: %d\n", hit_count + miss_count);
-        printf("# of Memory accesses: %d\n", mem_acc_count);
-        printf("Cache hit rate: %.1f%%\n", hit_rate);
-        printf("Cache miss rate: %.1f%%\n", miss_rate);
-        printf("CPU time(in cycle): %d\n", total_cycle);
-        printf("Instruction per cycle: %.5f\n", inst_per_cycle);
+    puts("");
+    printf("# of L1 cache accesses: %" PRIu64 "\n", hit_count + miss_count);
+    printf("# of Memory accesses: %" PRIu64 "\n", mem_acc_count);
+    printf("Cache hit rate: %.1f%%\n", hit_rate);
+    printf("Cache miss rate: %.1f%%\n", miss_rate);
+    printf("CPU time(in cycle): %" PRIu64 "\n", total_cycle);
+    printf("Instruction per cycle: %.5f\n", inst_per_cycle);
+    if (way_predict) {
+        printf("Same-block filter hits: %" PRIu64 " (%.1f%% of accesses)\n", filter_hit_count, 100.0 * filter_hit_count / (hit_count + miss_count));
+        printf("MRU way prediction accuracy: %.1f%% (%" PRIu64 "/%" PRIu64 ")\n", 100.0 * predict_hit_count / predict_count, predict_hit_count, predict_count);
+    }
+    if (tlb_levels) {
+        for (int i = 0; i < tlb_levels; i++)
+            printf("L%d TLB hit rate: %.1f%% (%" PRIu64 "/%" PRIu64 ")\n", i + 1, 100.0 * tlb_hit_count[i] / (tlb_hit_count[i] + tlb_miss_count[i]),
+                tlb_hit_count[i], tlb_hit_count[i] + tlb_miss_count[i]);
+        printf("# of page walks: %" PRIu64 "\n", walk_count);
+        if (inject_walk)
+            printf("# of page walk cache accesses: %" PRIu64 "\n", walk_access_count);
+        else
+            printf("Page walk cycles: %" PRIu64 "\n", walk_cycle_count);
+    }
+    if (compress_mode)
+        printcompress();
+    if (sector_size)
+        printsector();
+    if (victim_entries)
+        printvictim();
+    if (set_hist)
+        printsethist();
+    if (emit_count)
+        printf("# of miss trace records: %" PRIu64 "\n", emit_count);
+    if (miss_input)
+        printf("Upstream resident blocks: %" PRIu64 " (%" PRIu64 " dirty)\n", resident_count, resident_dirty_count);
+
+    // printf("total number of hits: %d\n", hit_count);
+    // printf("total number of misses: %d\n", miss_count);
+    // printf("total number of dirty blocks: %d\n", dirty_count);
+    // printf("total memory access cycle: %d\n", total_cycle);
+    // printf("average memory access cycle: %.1f\n", average_cycle);
+}
+
+// prints statistics as csv header and single row (no cache contents)
+void printcsv() {
+    puts("accesses,memory_accesses,hits,misses,cycles,instructions,hit_rate,miss_rate,ipc");
+    printf("%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.4f,%.4f,%.5f\n", hit_count + miss_count, mem_acc_count, hit_count, miss_count, total_cycle, insCnt,
+        100.0 * hit_count / (hit_count + miss_count), 100.0 * miss_count / (hit_count + miss_count), (double)insCnt / (double)total_cycle);
+}
+
+// prints effective capacity and compression ratio, compared with uncompressed baseline
+void printcompress() {
+    const char* compress_name[] = { "none", "zero", "bdi", "fpc" };
+    uint64_t accesses = hit_count + miss_count;
+    double avg_blocks = (double)valid_block_sum / accesses;
+    int64_t shadow_cycle = (int64_t)total_cycle - (int64_t)decompress_count * decompress_latency
+        + ((int64_t)shadow_mem_acc_count - (int64_t)mem_acc_count) * CYCLE_MEM_ACC;
+    double ipc = (double)insCnt / total_cycle, shadow_ipc = (double)insCnt / shadow_cycle;
+
+    // only uses options, statistics may come from result store without initcache
+    printf("Compression: %s, %d tag entries per block of data\n", compress_name[compress_mode], tag_factor);
+    printf("Effective capacity: %.2fx (%.1f blocks resident on average, %d without compression)\n", avg_blocks * block_size / cache_size,
+        avg_blocks, cache_size / block_size);
+    if (stored_byte_sum)
+        printf("Compression ratio: %.2f\n", (double)valid_block_sum * block_size / stored_byte_sum);
+    else
+        puts("Compression ratio: -");
+    printf("# of decompressions: %" PRIu64 " (%d cycles each)\n", decompress_count, decompress_latency);
+    printf("# of evictions to fit compressed blocks: %" PRIu64 "\n", compress_evict_count);
+    printf("Uncompressed baseline miss rate: %.1f%% (compressed %+.1f%%)\n", 100.0 * shadow_miss_count / accesses, 100.0 * ((double)miss_count - (double)shadow_miss_count) / accesses);
+    printf("Uncompressed baseline IPC: %.5f (compressed %+.1f%%)\n", shadow_ipc, 100.0 * (ipc - shadow_ipc) / shadow_ipc);
+}
+
+// prints sector misses and memory traffic of sectored cache
+void printsector() {
+    printf("Sector size: %d Bytes (%d per block)\n", sector_size, block_size / sector_size);
+    printf("# of sector misses (block present): %" PRIu64 "\n", sector_miss_count);
+    printf("Bytes read from memory: %" PRIu64 "\n", mem_read_bytes);
+    printf("Bytes written to memory: %" PRIu64 "\n", mem_write_bytes);
+}
+
+// prints victim buffer hits as share of main cache misses
+void printvictim() {
+    printf("Victim buffer: %d entries, %d cycles per hit, %s\n", victim_entries, victim_latency, victim_swap ? "swap on hit" : "no swap");
+    printf("Victim buffer hits: %" PRIu64 " (%.1f%% of misses recovered)\n", victim_hit_count, miss_count ? 100.0 * victim_hit_count / miss_count : 0.0);
+    printf("Victim buffer writebacks: %" PRIu64 "\n", victim_writeback_count);
+}
+
+// prints per-set access and conflict(eviction of valid block) distribution
+void printsethist() {
+    const char* func_name[] = { "modulo", "xor", "prime", "skew" };
+    uint64_t* count[2] = { set_access_count, set_conflict_count };
+    uint64_t min[2], max[2];
+    int hist[2][HIST_BUCKETS];
+    int bucket = 0, first = HIST_BUCKETS, last = 0;
+    double mean[2], var[2];
+
+    // per-set counts are not in result store, whose statistics are loaded without initcache
+    if (set_access_count == NULL) {
+        printf("Set index function: %s (per-set statistics not kept in result store)\n", func_name[index_func]);
+        return;
+    }
+
+    memset(hist, 0, sizeof(hist));
+    for (int c = 0; c < 2; c++) {
+        min[c] = max[c] = count[c][0];
+        mean[c] = var[c] = 0;
+        for (int i = 0; i < index_total; i++) {
+            if (count[c][i] < min[c])
+                min[c] = count[c][i];
+            if (count[c][i] > max[c])
+                max[c] = count[c][i];
+            mean[c] += count[c][i];
+            // bucket 0 holds 0, bucket k holds [2^(k-1), 2^k)
+            for (bucket = 0; bucket < HIST_BUCKETS - 1 && (count[c][i] >> bucket); bucket++);
+            hist[c][bucket]++;
+            if (bucket < first)
+                first = bucket;
+            if (bucket > last)
+                last = bucket;
+        }
+        mean[c] /= index_total;
+        for (int i = 0; i < index_total; i++)
+            var[c] += ((double)count[c][i] - mean[c]) * ((double)count[c][i] - mean[c]) / index_total;
+    }
 
-        // printf("total number of hits: %d\n", hit_count);
-        // printf("total number of misses: %d\n", miss_count);
-        // printf("total number of dirty blocks: %d\n", dirty_count);
-        // printf("total memory access cycle: %d\n", total_cycle);
-        // printf("average memory access cycle: %.1f\n", average_cycle);
+    printf("Set index function: %s (%d sets)\n", func_name[index_func], index_total);
+    printf("Per-set accesses: min %" PRIu64 ", max %" PRIu64 ", mean %.1f, cv %.3f\n", min[0], max[0], mean[0], mean[0] > 0 ? sqrt(var[0]) / mean[0] : 0.0);
+    printf("Per-set conflicts: min %" PRIu64 ", max %" PRIu64 ", mean %.1f, cv %.3f\n", min[1], max[1], mean[1], mean[1] > 0 ? sqrt(var[1]) / mean[1] : 0.0);
+    printf("%-20s %10s %10s\n", "count", "accesses", "conflicts");
+    for (int k = first; k <= last; k++) {
+        char range[48];
+
+        if (k == 0)
+            snprintf(range, sizeof(range), "0");
+        else if (k == HIST_BUCKETS - 1)
+            snprintf(range, sizeof(range), "[%" PRIu64 ", 2^64)", (uint64_t)1 << (k - 1));
+        else
+            snprintf(range, sizeof(range), "[%" PRIu64 ", %" PRIu64 ")", (uint64_t)1 << (k - 1), (uint64_t)1 << k);
+        printf("%-20s %10d %10d\n", range, hist[0][k], hist[1][k]);
     }
 }
 
-// free dynamically allocated memory
-void deallocate() {
-    MEMDATA* cur = NULL;
+// simulate one trace record
+// value is data of STORE given by trace, NULL when trace has none
+void simulate(char accesstype, uint64_t non_mem_acc_inst_cnt, uint64_t address_int, int* value) {
+    ADDRESS addr;
+    int data = 0;
+
+    insCnt++;
+    if (tlb_levels)
+        address_int = translate(address_int);
+    set_address_kernel(&addr, address_int);
+
+    if (accesstype == '0') {
+        insType = LOAD;
+        data = read_from_cache(addr);
+    }
+    else if (accesstype == '1') {
+        insType = STORE;
+        data = value ? *value : rand() % 65536; // DUMMY data when trace has no value
+        write_to_cache(addr, data);
+    }
+
+    // increment non-Memory access instruction cycle
+    total_cycle += (non_mem_acc_inst_cnt * CYCLE_NON_MEM_ACC);
+    // increment total instruction count
+    insCnt += non_mem_acc_inst_cnt;
+
+    if (verbose) {
+        if (insType == LOAD)
+            printf("[%" PRIu64 "] Read from %" PRIu64 " --> %d Found\n", timecnt - 1, address_int, data);
+        else if (insType == STORE)
+            printf("[%" PRIu64 "] Write %d to %" PRIu64 "\n", timecnt - 1, data, address_int);
+
+        puts("--------------------------------------------------------");
+        printresult(TRUE);
+        puts("--------------------------------------------------------");
+        printMemory(MEMptr);
+        puts("--------------------------------------------------------");
+    }
+
+    // print intermediate statistics every stats_interval records
+    record_count++;
+    if (stats_interval > 0 && record_count % stats_interval == 0) {
+        printf("\n[after %" PRIu64 " records]", record_count);
+        printstats();
+        fflush(stdout);
+    }
+    if (progress_interval > 0 && record_count % progress_interval == 0)
+        printprogress(FALSE);
+}
+
+// prints records simulated so far and throughput to stderr
+void printprogress(int done) {
+    struct timespec now;
+    double elapsed = 0;
+    uint64_t accesses = hit_count + miss_count;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = (now.tv_sec - progress_start.tv_sec) + (now.tv_nsec - progress_start.tv_nsec) / 1e9;
+    fprintf(stderr, "[%s] %" PRIu64 " records, %" PRIu64 " accesses, %.2f s, %.2f M records/s, miss rate %.2f%%\n", done ? "done" : "progress",
+        record_count, accesses, elapsed, elapsed > 0 ? record_count / elapsed / 1e6 : 0.0, accesses ? 100.0 * miss_count / accesses : 0.0);
+}
+
+// read optional data column after address of trace record, return TRUE when present
+int readvalue(FILE* fp, int* value) {
+    int c = 0;
+
+    while ((c = fgetc(fp)) == ' ' || c == '\t' || c == '\r');
+    if (c == '\n' || c == EOF)
+        return FALSE;
+    ungetc(c, fp);
+    return fscanf(fp, "%d", value) == 1;
+}
+
+// open miss trace output and write its header
+void openemit(const char* file_name) {
+    MISSHEADER hdr;
+
+    emit_fp = fopen(file_name, "wb");
+    if (emit_fp == NULL) {
+        printf("Cannot open miss trace output: %s\n", file_name);
+        exit(1);
+    }
+    setvbuf(emit_fp, NULL, _IOFBF, 1 << 20);
+
+    // geometry is filled in by closeemit, once parseargv has read every argument
+    memset(&hdr, 0, sizeof(hdr));
+    fwrite(&hdr, sizeof(hdr), 1, emit_fp);
+}
+
+// append miss trace record: instructions retired since previous record, then block address with type in low bits
+void emitrecord(int type, uint64_t blockaddr) {
+    uint64_t gap = insCnt - emit_last_insCnt;
+    uint64_t word = blockaddr | type;
+
+    emit_last_insCnt = insCnt;
+    fwrite(&gap, sizeof(gap), 1, emit_fp);
+    fwrite(&word, sizeof(word), 1, emit_fp);
+    emit_count++;
+}
+
+// record final cache contents and complete miss trace header
+void closeemit() {
+    MISSHEADER hdr;
 
-    // free Cache structure
     for (int i = 0; i < index_total; i++) {
         for (int j = 0; j < set_size; j++) {
-            free(cache[i].block[j].data);
+            if (cache[i].block[j].valid)
+                emitrecord(cache[i].block[j].dirty ? MISS_RESIDENT_DIRTY : MISS_RESIDENT, blocktoint(cache[i].block[j].tag, i));
         }
-        free(cache[i].block);
     }
-    free(cache);
 
-    // free Memory structure
-    if (MEMptr->head) {
-        for (cur = MEMptr->head->next; cur; cur = cur->next) {
-            free(cur->prev);
+    // blocks in victim buffer are still held on chip
+    for (int e = victim_mru; e >= 0; e = victim_buffer[e].next)
+        emitrecord(victim_buffer[e].dirty ? MISS_RESIDENT_DIRTY : MISS_RESIDENT, victim_buffer[e].blockaddr);
+
+    memcpy(hdr.magic, MISS_MAGIC, 4);
+    hdr.version = MISS_VERSION;
+    hdr.cache_size = cache_size;
+    hdr.set_size = data_ways;
+    hdr.block_size = block_size;
+    hdr.sector_size = sector_size;
+    fseek(emit_fp, 0, SEEK_SET);
+    fwrite(&hdr, sizeof(hdr), 1, emit_fp);
+    fclose(emit_fp);
+    emit_fp = NULL;
+}
+
+// simulate one miss trace record, gap upstream instructions are charged as non-memory-access instructions
+// record covers bytes of upstream cache, which take several accesses when this cache has smaller blocks (sectors)
+void simulate_miss(int type, uint64_t gap, uint64_t address_int, uint32_t bytes) {
+    ADDRESS addr;
+    uint32_t step = sector_size ? sector_size : block_size;
+
+    insCnt += gap;
+    total_cycle += (gap * CYCLE_NON_MEM_ACC);
+    record_count++;
+    if (progress_interval > 0 && record_count % progress_interval == 0)
+        printprogress(FALSE);
+
+    if (type == MISS_RESIDENT || type == MISS_RESIDENT_DIRTY) {
+        resident_count++;
+        if (type == MISS_RESIDENT)
+            return;
+        resident_dirty_count++;
+        // pending writeback is only performed when requested
+        if (!drain_resident)
+            return;
+    }
+
+    for (uint32_t offset = 0; offset == 0 || offset < bytes; offset += step) {
+        set_address_kernel(&addr, address_int + offset);
+        if (type == MISS_FILL)
+            read_from_cache(addr);
+        else
+            write_to_cache(addr, rand() % 65536); // DUMMY data
+    }
+}
+
+// simulate miss trace produced by -e option (header already checked)
+void readmisstrace(FILE* fp, MISSHEADER* hdr) {
+    uint64_t gap = 0;
+    uint64_t word = 0;
+    uint32_t transfer = hdr->sector_size ? hdr->sector_size : hdr->block_size; // bytes of FILL and WRITEBACK
+
+    miss_input = TRUE;
+    while (fread(&gap, sizeof(gap), 1, fp) == 1 && fread(&word, sizeof(word), 1, fp) == 1)
+        simulate_miss(word & 3, gap, word & ~(uint64_t)3, (word & 3) < MISS_RESIDENT ? transfer : hdr->block_size);
+}
+
+// allocate TLB entries (after initcache, page coloring needs cache geometry)
+void inittlb() {
+    for (int i = 0; i < tlb_levels; i++) {
+        tlb[i].sets = tlb[i].entries / tlb[i].ways;
+        tlb[i].entry = (TLBENTRY*)calloc(tlb[i].entries, sizeof(TLBENTRY));
+    }
+}
+
+// scramble bits of x (splitmix64 finalizer)
+uint64_t mix64(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+// return log2 of page size backing virtual address, same for every address of a 1G / 2M region
+int pageshift(uint64_t va) {
+    if ((int)(mix64((va >> 30) ^ 0x1E) % 100) < page_mix[2])
+        return 30;
+    if (page_mix[0] + page_mix[1] > 0 && (int)(mix64((va >> 21) ^ 0x2D) % (page_mix[0] + page_mix[1])) < page_mix[1])
+        return 21;
+    return 12;
+}
+
+// look up page in TLB and update its LRU time
+int tlblookup(TLB* t, uint64_t vpn, int shift) {
+    TLBENTRY* set = &t->entry[(vpn % t->sets) * t->ways];
+
+    for (int i = 0; i < t->ways; i++) {
+        if (set[i].valid && set[i].vpn == vpn && set[i].shift == shift) {
+            set[i].lastused = tlb_time;
+            return TRUE;
         }
-        free(cur);
     }
+    return FALSE;
 }
 
+// put page in TLB, replacing empty or LRU entry of its set
+void tlbinsert(TLB* t, uint64_t vpn, int shift) {
+    TLBENTRY* set = &t->entry[(vpn % t->sets) * t->ways];
+    int victim = 0;
 
-int main(int argc, char* argv[]) {
-    FILE* fp = NULL;
+    for (int i = 0; i < t->ways; i++) {
+        if (!set[i].valid) {
+            victim = i;
+            break;
+        }
+        if (set[i].lastused < set[victim].lastused)
+            victim = i;
+    }
+    set[victim].vpn = vpn;
+    set[victim].shift = shift;
+    set[victim].valid = 1;
+    set[victim].lastused = tlb_time;
+}
+
+// invertible mix of bits-bit value (odd multiply and xorshift, each modulo 2^bits)
+uint64_t permutebits(uint64_t x, int bits) {
+    uint64_t mask = ((uint64_t)1 << bits) - 1;
+    int s = bits / 2 + 1;
+
+    x = (x * 0xBF58476D1CE4E5B9ULL) & mask;
+    x ^= x >> s;
+    x = (x * 0x94D049BB133111EBULL) & mask;
+    x ^= x >> s;
+    x = (x * 0xBF58476D1CE4E5B9ULL) & mask;
+    return x ^ (x >> s);
+}
+
+// return physical frame number of virtual page under map_policy
+uint64_t physframe(uint64_t vpn, int shift) {
+    int frame_bits = VIRT_BITS - shift;
+    int color_bit = index_bit + byte_offset - shift; // cache index bits above page offset
+    uint64_t region = shift == 12 ? 0 : shift == 21 ? 1 : 2;
+    uint64_t frame = vpn; // below 2^frame_bits, checked by translate
+
+    if (map_policy == MAP_IDENTITY)
+        return vpn;
+
+    // random frame is a permutation of whole page number inside region of its page size,
+    // so no page table has to be kept and distinct pages never share a frame
+    if (map_policy != MAP_COLOR || color_bit < 0)
+        color_bit = 0;
+    if (color_bit > frame_bits)
+        color_bit = frame_bits;
+    frame = (permutebits(frame >> color_bit, frame_bits - color_bit) << color_bit) | (frame & (((uint64_t)1 << color_bit) - 1));
+    return (region << frame_bits) | frame;
+}
+
+// walk 4-level radix page table (leaf at level 4 / 3 / 2 for 4K / 2M / 1G page)
+void pagewalk(uint64_t va, int shift) {
+    int levels = (shift == 12) ? 4 : (shift == 21) ? 3 : 2;
+    uint64_t table = 0, pte_addr = 0;
     ADDRESS addr;
-    char accesstype;
-    int non_mem_acc_inst_cnt;
-    char address[20];
-    char* file_name;
-    uint64_t address_int = 0;
-    int data;
 
-    // check and parse argument passed to program
-    parseargv(argc, argv, &cache_size, &block_size, &set_size, &file_name);
+    walk_count++;
+    if (!inject_walk) {
+        walk_cycle_count += walk_cycles * levels;
+        total_cycle += walk_cycles * levels;
+        return;
+    }
 
-    // initalize the cache structure
-    initcache();
+    // read PTE of each level through cache: table is located by hash of bits above its coverage
+    for (int level = 1; level <= levels; level++) {
+        table = mix64(((uint64_t)level << 60) ^ (va >> (12 + 9 * (5 - level)))) & (((uint64_t)1 << (VIRT_BITS - 12)) - 1);
+        pte_addr = PAGE_TABLE_BASE + (table << 12) + ((va >> (12 + 9 * (4 - level))) & 511) * 8;
+        set_address_kernel(&addr, pte_addr);
+        read_from_cache(addr);
+        walk_access_count++;
+    }
+}
 
-    // read memory access log from trace file and simulate the operation
-    fp = fopen(file_name, "r");
-    while (EOF != fscanf(fp, "%c", &accesstype)) {
-        if (accesstype == '#')
-            break; // break if meet #eof mark
-        fscanf(fp, "%d %s\n", &non_mem_acc_inst_cnt, address);
-        
-        insCnt++;
-        address_int = strtol(address, NULL, 10);
-        set_address(&addr, address_int);
+// translate virtual address of trace to physical address through TLBs
+uint64_t translate(uint64_t va) {
+    int shift = pageshift(va);
+    uint64_t vpn = va >> shift;
+
+    // random frames are unique only inside virtual address space of VIRT_BITS
+    if (map_policy != MAP_IDENTITY && (va >> VIRT_BITS)) {
+        printf("Virtual address %" PRIu64 " exceeds %d bits (use -map=identity)\n", va, VIRT_BITS);
+        exit(1);
+    }
 
-        if (accesstype == '0') {
-            insType = LOAD;
-            data = read_from_cache(addr);
+    tlb_time++;
+    if (tlblookup(&tlb[0], vpn, shift))
+        tlb_hit_count[0]++;
+    else {
+        tlb_miss_count[0]++;
+        if (tlb_levels == 2 && tlblookup(&tlb[1], vpn, shift)) {
+            tlb_hit_count[1]++;
+            total_cycle += CYCLE_TLB2_HIT;
         }
-        else if (accesstype == '1') {
-            insType = STORE;
-            // fscanf(fp, "%d", &data);
-            data = rand() % 65536; // DUMMY data
-            write_to_cache(addr, data);
+        else {
+            if (tlb_levels == 2) {
+                tlb_miss_count[1]++;
+                total_cycle += CYCLE_TLB2_HIT;
+                tlbinsert(&tlb[1], vpn, shift);
+            }
+            pagewalk(va, shift);
         }
+        tlbinsert(&tlb[0], vpn, shift);
+    }
+
+    return (physframe(vpn, shift) << shift) | (va & (((uint64_t)1 << shift) - 1));
+}
 
-        // increment non-Memory access instruction cycle
-        total_cycle += (non_mem_acc_inst_cnt * CYCLE_NON_MEM_ACC);
-        // increment total instruction count
-        insCnt += non_mem_acc_inst_cnt;
+// hash buffer 8 Bytes at a time (multiply-xorshift), continuing from h
+uint64_t hashbytes(uint64_t h, const unsigned char* buf, size_t len) {
+    uint64_t word = 0;
+    size_t i = 0;
 
-        if (verbose) {
-            if (insType == LOAD)
-                printf("[%d] Read from %s --> %d Found\n", timecnt - 1, address, data);
-            else if (insType == STORE)
-                printf("[%d] Write %d to %s\n", timecnt - 1, data, address);
+    for (i = 0; i + 8 <= len; i += 8) {
+        memcpy(&word, buf + i, 8);
+        h = (h ^ word) * 0x9E3779B97F4A7C15ULL;
+        h ^= h >> 32;
+    }
+    for (; i < len; i++) {
+        h = (h ^ buf[i]) * 0x100000001B3ULL;
+    }
+    return h ^ len;
+}
+
+// return result store key of trace file and every option affecting statistics
+uint64_t resultkey(const char* file_name) {
+    unsigned char* buf = (unsigned char*)malloc(SAMPLE_SIZE);
+    struct stat st;
+    char config[512];
+    uint64_t h = 0xCBF29CE484222325ULL;
+    off_t offset[3];
+    size_t n = 0;
+    FILE* fp = fopen(file_name, "rb");
+
+    if (fp == NULL || fstat(fileno(fp), &st) < 0) {
+        printf("Cannot open trace file: %s\n", file_name);
+        exit(1);
+    }
 
-            puts("--------------------------------------------------------");
-            printresult(TRUE);
-            puts("--------------------------------------------------------");
-            printMemory(MEMptr);
-            puts("--------------------------------------------------------");
+    if (fingerprint_mode == FINGERPRINT_FULL) {
+        // streaming hash of whole trace
+        while ((n = fread(buf, 1, SAMPLE_SIZE, fp)) > 0)
+            h = hashbytes(h, buf, n);
+    }
+    else {
+        // size and mtime, plus hash of first, middle and last SAMPLE_SIZE Bytes
+        h = hashbytes(h, (unsigned char*)&st.st_size, sizeof(st.st_size));
+        h = hashbytes(h, (unsigned char*)&st.st_mtim, sizeof(st.st_mtim));
+        offset[0] = 0;
+        offset[1] = st.st_size / 2;
+        offset[2] = st.st_size > SAMPLE_SIZE ? st.st_size - SAMPLE_SIZE : 0;
+        for (int i = 0; i < 3; i++) {
+            fseeko(fp, offset[i], SEEK_SET);
+            n = fread(buf, 1, SAMPLE_SIZE, fp);
+            h = hashbytes(h, buf, n);
         }
     }
+    fclose(fp);
+    free(buf);
+
+    // simulator version and cycle constants invalidate old entries
+    snprintf(config, sizeof(config), "%s %d %d %d %d %d %d %d %d %d %d %d %" PRIu64, CACHESIM_VERSION, fingerprint_mode, BIT_MAX, WORDSIZE,
+        CYCLE_NON_MEM_ACC, CYCLE_CACHE_HIT, CYCLE_MEM_ACC, cache_size, set_size, block_size, way_predict, drain_resident, record_limit);
+    h = hashbytes(h, (unsigned char*)config, strlen(config));
+    snprintf(config, sizeof(config), "tlb %d %d %d %d %d %d %d %d %d %d %d %d %d index %d", CYCLE_TLB2_HIT, CYCLE_PAGE_WALK, tlb_levels, tlb[0].entries,
+        tlb[0].ways, tlb[1].entries, tlb[1].ways, page_mix[0], page_mix[1], page_mix[2], walk_cycles, inject_walk, map_policy, index_func);
+    h = hashbytes(h, (unsigned char*)config, strlen(config));
+    snprintf(config, sizeof(config), "compress %d %d %d %d sector %d victim %d %d %d", COMPRESS_SEGMENT, compress_mode, tag_factor,
+        decompress_latency, sector_size, victim_entries, victim_latency, victim_swap);
+    return hashbytes(h, (unsigned char*)config, strlen(config));
+}
+
+// load statistics of key from result store, return FALSE when not stored
+int loadresult(uint64_t key) {
+    char path[4096], name[64], version[64];
+    unsigned long long value = 0;
+    int found = 0;
+    FILE* fp = NULL;
 
-    // close input file
+    snprintf(path, sizeof(path), "%s/%016llx.res", result_dir, (unsigned long long)key);
+    fp = fopen(path, "r");
+    if (fp == NULL)
+        return FALSE;
+
+    // entries are renamed into place complete, but still check version and every field
+    if (fscanf(fp, "cachesim %63s\n", version) != 1 || strcmp(version, CACHESIM_VERSION)) {
+        fclose(fp);
+        return FALSE;
+    }
+    while (fscanf(fp, "%63s %llu\n", name, &value) == 2) {
+        for (size_t i = 0; i < sizeof(result_field) / sizeof(RESULTFIELD); i++) {
+            if (!strcmp(name, result_field[i].name)) {
+                *result_field[i].value = value;
+                found++;
+            }
+        }
+    }
     fclose(fp);
+    return found == sizeof(result_field) / sizeof(RESULTFIELD);
+}
+
+// store statistics of key, safe against concurrent writers (write private file, then atomic rename)
+void storeresult(uint64_t key) {
+    char path[4096], tmppath[4096];
+    FILE* fp = NULL;
+
+    if (mkdir(result_dir, 0755) < 0 && errno != EEXIST)
+        return;
+    snprintf(path, sizeof(path), "%s/%016llx.res", result_dir, (unsigned long long)key);
+    snprintf(tmppath, sizeof(tmppath), "%s/.%016llx.%ld.tmp", result_dir, (unsigned long long)key, (long)getpid());
+
+    fp = fopen(tmppath, "w");
+    if (fp == NULL)
+        return;
+    fprintf(fp, "cachesim %s\n", CACHESIM_VERSION);
+    for (size_t i = 0; i < sizeof(result_field) / sizeof(RESULTFIELD); i++)
+        fprintf(fp, "%s %llu\n", result_field[i].name, (unsigned long long)*result_field[i].value);
+    if (fclose(fp) != 0 || rename(tmppath, path) < 0)
+        unlink(tmppath);
+}
+
+// attach to shared-memory ring buffer (wait until producer creates it)
+SHMRING* attach_shm(const char* name) {
+    SHMRING* ring = NULL;
+    struct stat st;
+    struct timespec wait = { 0, 1000000 }; // 1ms
+    int fd = -1;
+
+    // producer may start after simulator, so retry until object exists, is sized and its header is published
+    // object is reopened on every retry, because producer replaces one left behind by earlier run
+    while (TRUE) {
+        if ((fd = shm_open(name, O_RDWR, 0600)) >= 0 && fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(SHMRING)) {
+            ring = (SHMRING*)mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (ring == MAP_FAILED) {
+                perror("mmap");
+                exit(1);
+            }
+            if (__atomic_load_n(&ring->magic, __ATOMIC_ACQUIRE) == SHM_MAGIC) {
+                if (ring->version != SHM_VERSION || (size_t)st.st_size < shm_ring_size(ring->capacity)) {
+                    puts("Incompatible shared memory ring buffer");
+                    exit(1);
+                }
+                // ring already attached belongs to killed consumer, wait for producer to replace it
+                if (!__atomic_exchange_n(&ring->attached, 1, __ATOMIC_ACQ_REL)) {
+                    close(fd);
+                    return ring;
+                }
+            }
+            munmap(ring, st.st_size);
+        }
+        if (fd >= 0)
+            close(fd);
+        nanosleep(&wait, NULL);
+    }
+}
+
+// simulate records as producer publishes them, until ring is closed and drained
+void consume_shm(SHMRING* ring) {
+    struct timespec wait = { 0, 10000 }; // 10us
+    uint64_t mask = ring->capacity - 1;
+    uint64_t batch = ring->capacity / 4 + 1; // hand slots back to producer at least this often
+    uint64_t tail = ring->tail, head = 0;
+    SHMRECORD rec;
+
+    while (TRUE) {
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            // closed is set after last head update -> recheck head once closed is seen
+            if (__atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE) && __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail)
+                break;
+            nanosleep(&wait, NULL);
+            continue;
+        }
+        if (head - tail > batch)
+            head = tail + batch;
+
+        for (; tail != head; tail++) {
+            rec = ring->record[tail & mask];
+            simulate(rec.insType == SHM_STORE ? '1' : '0', rec.insCnt, rec.address, NULL);
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+}
+
+// free dynamically allocated memory
+void deallocate() {
+    // free Cache structure
+    munmap(arena, arena_size);
+    arena = NULL;
+    cache = NULL;
+    free(shadow);
+    shadow = NULL;
+
+    // free victim buffer (entry data lives in victim_scratch)
+    free(victim_buffer);
+    free(victim_bucket);
+    free(victim_scratch);
+
+    // free Memory structure
+    free(MEMptr->entry);
+    free(MEMptr->bucket);
+    free(MEMptr);
+    MEMptr = NULL;
+
+    // free TLB
+    for (int i = 0; i < tlb_levels; i++)
+        free(tlb[i].entry);
+}
+
+
+int cachesim_main(int argc, char* argv[]) {
+    FILE* fp = NULL;
+    SHMRING* ring = NULL;
+    char accesstype;
+    uint64_t non_mem_acc_inst_cnt;
+    int value = 0, hasvalue = FALSE;
+    char address[32];
+    char* file_name = NULL;
+    uint64_t address_int = 0;
+    uint64_t key = 0;
+    MISSHEADER hdr;
+
+    // check and parse argument passed to program
+    parseargv(argc, argv, &cache_size, &block_size, &set_size, &file_name);
+#ifdef CACHESIM_PROFILE
+    prof_start_tick = prof_now();
+    clock_gettime(CLOCK_MONOTONIC, &prof_start_time);
+#endif
+
+    // answer repeated (trace, configuration) from result store, miss trace output needs real run
+    if (result_dir && file_name && !emit_fp) {
+        key = resultkey(file_name);
+        if (loadresult(key)) {
+            if (output_mode == OUTPUT_CSV)
+                printcsv();
+            else {
+                puts("(statistics from result store, cache contents not simulated)");
+                printstats();
+            }
+            return 0;
+        }
+    }
+
+    // initalize the cache structure
+    clock_gettime(CLOCK_MONOTONIC, &progress_start);
+    initcache();
+    inittlb();
+    initvictim();
+
+    if (shm_name) {
+        // simulate records online from shared-memory ring buffer
+        ring = attach_shm(shm_name);
+        consume_shm(ring);
+        munmap(ring, shm_ring_size(ring->capacity));
+        shm_unlink(shm_name);
+    }
+    else {
+        // read memory access log from trace file and simulate the operation
+        fp = fopen(file_name, "r");
+        if (fp == NULL) {
+            printf("Cannot open trace file: %s\n", file_name);
+            exit(1);
+        }
+        // binary miss trace starts with magic, anything else is text trace
+        if (fread(&hdr, sizeof(hdr), 1, fp) == 1 && !memcmp(hdr.magic, MISS_MAGIC, 4)) {
+            if (hdr.version != MISS_VERSION) {
+                puts("Unsupported miss trace version");
+                exit(1);
+            }
+            readmisstrace(fp, &hdr);
+        }
+        else {
+            rewind(fp);
+            while (EOF != fscanf(fp, "%c", &accesstype)) {
+                if (accesstype == '#')
+                    break; // break if meet #eof mark
+                if (record_limit > 0 && record_count >= record_limit)
+                    break; // only simulate prefix of trace
+                PROF_BEGIN(PROF_PARSE);
+                fscanf(fp, "%" SCNu64 " %31s", &non_mem_acc_inst_cnt, address);
+                address_int = strtoull(address, NULL, 10);
+                hasvalue = readvalue(fp, &value);
+                fscanf(fp, " ");
+                PROF_END(PROF_PARSE);
+                simulate(accesstype, non_mem_acc_inst_cnt, address_int, hasvalue ? &value : NULL);
+            }
+        }
+
+        // close input file
+        fclose(fp);
+    }
+
+    if (progress_interval > 0)
+        printprogress(TRUE);
+
+    // write final cache contents to miss trace
+    if (emit_fp)
+        closeemit();
+    if (key)
+        storeresult(key);
 
     // prints out simulation result
-    printresult(TRUE);
+    PROF_BEGIN(PROF_REPORT);
+    if (output_mode == OUTPUT_CSV)
+        printcsv();
+    else
+        printresult(TRUE);
     if (verbose)
         printMemory(MEMptr);
+    fflush(stdout);
+    PROF_END(PROF_REPORT);
+#ifdef CACHESIM_PROFILE
+    if (profile)
+        printprofile();
+#endif
 
     // free allocated memory
     deallocate();
 
     return 0;
 }
+
+#ifdef CACHESIM_PROFILE
+// return current timer tick (TSC on x86, nanoseconds otherwise)
+uint64_t prof_now() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+// prints time spent in each stage to stderr (stages are inclusive: miss includes memory)
+void printprofile() {
+    const char* stage_name[PROF_STAGES] = { "parse", "lookup", "miss", "memory", "report" };
+    struct timespec end_time;
+    struct rusage usage;
+    double total_ns = 0, ns_per_tick = 0, stage_ns = 0;
+    uint64_t accesses = hit_count + miss_count;
+
+    // calibrate ticks against monotonic clock over whole run
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    total_ns = (end_time.tv_sec - prof_start_time.tv_sec) * 1e9 + (end_time.tv_nsec - prof_start_time.tv_nsec);
+    ns_per_tick = total_ns / (double)(prof_now() - prof_start_tick);
+    getrusage(RUSAGE_SELF, &usage);
+
+    fputs("\nProfile (miss includes memory):\n", stderr);
+    fprintf(stderr, "%-8s %12s %12s %7s %10s\n", "stage", "calls", "time(ms)", "share", "ns/call");
+    for (int i = 0; i < PROF_STAGES; i++) {
+        stage_ns = prof_ticks[i] * ns_per_tick;
+        fprintf(stderr, "%-8s %12" PRIu64 " %12.3f %6.1f%% %10.1f\n", stage_name[i], prof_calls[i], stage_ns / 1e6,
+            100.0 * stage_ns / total_ns, prof_calls[i] ? stage_ns / prof_calls[i] : 0.0);
+    }
+    fprintf(stderr, "%-8s %12s %12.3f\n", "total", "", total_ns / 1e6);
+    fprintf(stderr, "Accesses per second: %.0f\n", accesses / (total_ns / 1e9));
+    fprintf(stderr, "ns per access: %.1f\n", total_ns / accesses);
+    fprintf(stderr, "Peak RSS: %ld KB\n", usage.ru_maxrss);
+}
+#endif
+
+// cachesim-batch.c includes this file with CACHESIM_LIBRARY defined and calls cachesim_main per job
+#ifndef CACHESIM_LIBRARY
+int main(int argc, char* argv[]) {
+    return cachesim_main(argc, argv);
+}
+#endif
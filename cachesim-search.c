@@ -0,0 +1,360 @@
+// file: cachesim-search.c
+// author : Ryu Hyung Uk
+// description : Program to search cache design space (cache size, set size, block size, policy) of one trace
+// usage: ./cachesim-search -f=<trace file name> [-m=<max miss rate(%)> | -k=<size budget(in Bytes)>] [-S=<min size>:<max size>]
+//            [-A=<set sizes>] [-B=<block sizes>] [-x=<policy options>]... [-p=<prefix records>] [-g=<prune margin(%)>]
+//            [-j=<worker count>] [-o=<frontier csv>]
+
+// every evaluation is a job of cachesim-batch job runner
+#define CACHESIM_BATCH_LIBRARY
+#include "cachesim-batch.c"
+
+#define OBJ_FRONTIER 0 // search objective: whole size / miss rate / IPC Pareto frontier
+#define OBJ_MISS 1 // smallest cache with miss rate <= target
+#define OBJ_IPC 2 // best IPC with cache size <= budget
+#define MAX_CHOICES 16
+#define MAX_POLICIES 8
+
+
+// define structure
+typedef struct CANDIDATE {
+    int cache_size, set_size, block_size, policy;
+    int valid; // geometry is simulatable
+    int pruned; // clearly dominated on trace prefix
+    int evaluated; // simulated over whole trace
+    double prefix_miss_rate, prefix_ipc;
+    double miss_rate, ipc;
+    int job; // index of job in current round
+} CANDIDATE;
+
+
+// define global variables
+char* trace_name = NULL;
+int objective = OBJ_FRONTIER;
+double target_miss_rate = 0, prune_margin = 1.0;
+int size_budget = 0, prefix_records = 0;
+int min_size = 1024, max_size = 1024 * 1024;
+int set_choice[MAX_CHOICES] = { 1, 2, 4, 8, 16 }, set_choice_count = 5;
+int block_choice[MAX_CHOICES] = { 64, 128 }, block_choice_count = 2;
+char* policy[MAX_POLICIES] = { "" };
+int policy_count = 1;
+CANDIDATE* candidate = NULL;
+int size_count = 0, series_count = 0, candidate_count = 0;
+int full_eval_count = 0;
+
+
+// define functions
+void search_usage(char*);
+int parselist(char*, int*);
+void buildcandidates();
+void evaluate(int*, int, int);
+void prunedominated();
+void searchfrontier();
+void searchmiss();
+void searchipc();
+int dominates(CANDIDATE*, CANDIDATE*);
+void writefrontier(const char*, CANDIDATE*);
+
+
+// print usage and terminate program
+void search_usage(char* program_name) {
+    printf("Usage: %s -f=<trace file name> [-m=<max miss rate(%%)> | -k=<size budget(in Bytes)>] [-S=<min size>:<max size>]\n", program_name);
+    puts("       [-A=<set sizes>] [-B=<block sizes>] [-x=<policy options>]... [-p=<prefix records>] [-g=<prune margin(%)>]");
+    puts("       [-j=<worker count>] [-o=<frontier csv>]");
+    exit(1);
+}
+
+// parse comma separated integer list, return number of items
+int parselist(char* value, int* list) {
+    int count = 0;
+
+    for (char* tok = strtok(value, ","); tok && count < MAX_CHOICES; tok = strtok(NULL, ","))
+        list[count++] = atoi(tok);
+    return count;
+}
+
+// enumerate every (policy, set size, block size) series over power-of-2 sizes in [min_size, max_size]
+// candidate index = series * size_count + size index, so each series is sorted by size
+void buildcandidates() {
+    CANDIDATE* c = NULL;
+    int sets = 0;
+
+    for (int size = min_size; size <= max_size; size *= 2)
+        size_count++;
+    series_count = policy_count * set_choice_count * block_choice_count;
+    candidate_count = series_count * size_count;
+    candidate = (CANDIDATE*)calloc(candidate_count, sizeof(CANDIDATE));
+
+    for (int p = 0; p < policy_count; p++)
+        for (int a = 0; a < set_choice_count; a++)
+            for (int b = 0; b < block_choice_count; b++)
+                for (int k = 0, size = min_size; k < size_count; k++, size *= 2) {
+                    c = &candidate[((p * set_choice_count + a) * block_choice_count + b) * size_count + k];
+                    c->cache_size = size;
+                    c->set_size = set_choice[a];
+                    c->block_size = block_choice[b];
+                    c->policy = p;
+                    // set count must be power of 2 for index bits
+                    sets = (set_choice[a] * block_choice[b] > 0) ? size / (set_choice[a] * block_choice[b]) : 0;
+                    c->valid = block_choice[b] >= WORDSIZE && sets > 0 && (sets & (sets - 1)) == 0 && sets * set_choice[a] * block_choice[b] == size;
+                }
+}
+
+// simulate candidates in parallel, over first prefix records (prefix > 0) or whole trace
+void evaluate(int* list, int n, int prefix) {
+    char options[MAX_LINE];
+    CANDIDATE* c = NULL;
+
+    for (int i = 0; i < n; i++) {
+        c = &candidate[list[i]];
+        if (prefix > 0)
+            snprintf(options, sizeof(options), "%s -n=%d", policy[c->policy], prefix);
+        else
+            snprintf(options, sizeof(options), "%s", policy[c->policy]);
+        c->job = addjob(trace_name, c->cache_size, c->set_size, c->block_size, options);
+    }
+    runjobs();
+
+    for (int i = 0; i < n; i++) {
+        c = &candidate[list[i]];
+        if (prefix > 0) {
+            if (!jobresult(&jobs[c->job], &c->prefix_miss_rate, &c->prefix_ipc))
+                c->valid = FALSE;
+        }
+        else {
+            c->evaluated = jobresult(&jobs[c->job], &c->miss_rate, &c->ipc);
+            c->valid = c->evaluated;
+            full_eval_count++;
+        }
+    }
+}
+
+// drop candidates beaten on trace prefix by a no larger cache with margin lower miss rate and no lower IPC
+void prunedominated() {
+    int* list = (int*)malloc(sizeof(int) * candidate_count);
+    int n = 0, pruned = 0;
+    CANDIDATE* x = NULL;
+    CANDIDATE* y = NULL;
+
+    for (int i = 0; i < candidate_count; i++)
+        if (candidate[i].valid)
+            list[n++] = i;
+    evaluate(list, n, prefix_records);
+
+    for (int i = 0; i < n; i++) {
+        x = &candidate[list[i]];
+        for (int j = 0; j < n && x->valid && !x->pruned; j++) {
+            y = &candidate[list[j]];
+            if (j != i && y->valid && y->cache_size <= x->cache_size && y->prefix_miss_rate + prune_margin <= x->prefix_miss_rate && y->prefix_ipc >= x->prefix_ipc) {
+                x->pruned = TRUE;
+                pruned++;
+            }
+        }
+    }
+    fprintf(stderr, "prefix of %d records: %d candidates, %d pruned\n", prefix_records, n, pruned);
+    free(list);
+}
+
+// evaluate every remaining candidate
+void searchfrontier() {
+    int* list = (int*)malloc(sizeof(int) * candidate_count);
+    int n = 0;
+
+    for (int i = 0; i < candidate_count; i++)
+        if (candidate[i].valid && !candidate[i].pruned)
+            list[n++] = i;
+    evaluate(list, n, 0);
+    free(list);
+}
+
+// binary search each series for smallest size meeting target (miss rate assumed non-increasing with size),
+// one step of every series per round so that rounds run in parallel
+void searchmiss() {
+    int* lo = (int*)calloc(series_count, sizeof(int));
+    int* hi = (int*)malloc(sizeof(int) * series_count);
+    int* list = (int*)malloc(sizeof(int) * series_count);
+    int n = 0, k = 0, best_size = 0;
+    CANDIDATE* c = NULL;
+
+    for (int s = 0; s < series_count; s++)
+        hi[s] = size_count;
+
+    while (TRUE) {
+        n = 0;
+        for (int s = 0; s < series_count; s++) {
+            // skip sizes this series can't simulate (too small or pruned on prefix)
+            while (lo[s] < hi[s] && (!candidate[s * size_count + lo[s]].valid || candidate[s * size_count + lo[s]].pruned))
+                lo[s]++;
+            // series can't beat best size found so far
+            if (lo[s] >= hi[s] || (best_size && candidate[s * size_count + lo[s]].cache_size > best_size))
+                continue;
+            k = (lo[s] + hi[s]) / 2;
+            if (!candidate[s * size_count + k].valid || candidate[s * size_count + k].pruned)
+                k = lo[s];
+            list[n++] = s * size_count + k;
+        }
+        if (n == 0)
+            break;
+        evaluate(list, n, 0);
+
+        for (int i = 0; i < n; i++) {
+            int s = list[i] / size_count;
+
+            k = list[i] % size_count;
+            c = &candidate[list[i]];
+            if (c->evaluated && c->miss_rate <= target_miss_rate) {
+                hi[s] = k;
+                if (!best_size || c->cache_size < best_size)
+                    best_size = c->cache_size;
+            }
+            else
+                lo[s] = k + 1;
+        }
+    }
+    free(lo);
+    free(hi);
+    free(list);
+}
+
+// IPC is assumed non-decreasing with size, so only the largest size within budget of each series is simulated
+void searchipc() {
+    int* list = (int*)malloc(sizeof(int) * series_count);
+    int n = 0;
+
+    for (int s = 0; s < series_count; s++) {
+        for (int k = size_count - 1; k >= 0; k--) {
+            CANDIDATE* c = &candidate[s * size_count + k];
+            if (c->valid && !c->pruned && c->cache_size <= size_budget) {
+                list[n++] = s * size_count + k;
+                break;
+            }
+        }
+    }
+    evaluate(list, n, 0);
+    free(list);
+}
+
+// check if x is at least as good as y in size, miss rate and IPC, and better in one
+int dominates(CANDIDATE* x, CANDIDATE* y) {
+    if (x->cache_size > y->cache_size || x->miss_rate > y->miss_rate || x->ipc < y->ipc)
+        return FALSE;
+    return x->cache_size < y->cache_size || x->miss_rate < y->miss_rate || x->ipc > y->ipc;
+}
+
+// write Pareto frontier of evaluated candidates (size vs miss rate vs IPC) in size order
+void writefrontier(const char* file_name, CANDIDATE* best) {
+    FILE* fp = file_name ? fopen(file_name, "w") : stdout;
+    int on_frontier = FALSE;
+
+    if (fp == NULL) {
+        printf("Cannot open frontier file: %s\n", file_name);
+        exit(1);
+    }
+    fputs("cache_size,set_size,block_size,policy,miss_rate,ipc,best\n", fp);
+    for (int size = min_size; size <= max_size; size *= 2) {
+        for (int i = 0; i < candidate_count; i++) {
+            if (!candidate[i].evaluated || candidate[i].cache_size != size)
+                continue;
+            on_frontier = TRUE;
+            for (int j = 0; j < candidate_count && on_frontier; j++)
+                if (candidate[j].evaluated && dominates(&candidate[j], &candidate[i]))
+                    on_frontier = FALSE;
+            if (on_frontier)
+                fprintf(fp, "%d,%d,%d,\"%s\",%.4f,%.5f,%d\n", candidate[i].cache_size, candidate[i].set_size, candidate[i].block_size,
+                    policy[candidate[i].policy], candidate[i].miss_rate, candidate[i].ipc, &candidate[i] == best);
+        }
+    }
+    if (file_name)
+        fclose(fp);
+}
+
+
+int main(int argc, char* argv[]) {
+    char* ch = NULL;
+    char* value = NULL;
+    char* frontier_name = NULL;
+    CANDIDATE* best = NULL;
+    CANDIDATE* c = NULL;
+
+    worker_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    // parse passed argument
+    for (int i = 1; i < argc; i++) {
+        ch = strtok(argv[i], "=-");
+        value = strtok(NULL, "\0");
+        if (ch == NULL || value == NULL)
+            search_usage(argv[0]);
+
+        if (!strcmp(ch, "f"))
+            trace_name = value;
+        else if (!strcmp(ch, "m")) {
+            objective = OBJ_MISS;
+            target_miss_rate = atof(value);
+        }
+        else if (!strcmp(ch, "k")) {
+            objective = OBJ_IPC;
+            size_budget = atoi(value);
+        }
+        else if (!strcmp(ch, "S") && strchr(value, ':')) {
+            min_size = atoi(value);
+            max_size = atoi(strchr(value, ':') + 1);
+        }
+        else if (!strcmp(ch, "A"))
+            set_choice_count = parselist(value, set_choice);
+        else if (!strcmp(ch, "B"))
+            block_choice_count = parselist(value, block_choice);
+        else if (!strcmp(ch, "x") && policy_count < MAX_POLICIES) {
+            // first -x replaces default policy
+            if (policy[0][0] == '\0' && policy_count == 1)
+                policy_count = 0;
+            policy[policy_count++] = value;
+        }
+        else if (!strcmp(ch, "p"))
+            prefix_records = atoi(value);
+        else if (!strcmp(ch, "g"))
+            prune_margin = atof(value);
+        else if (!strcmp(ch, "j"))
+            worker_count = atoi(value);
+        else if (!strcmp(ch, "o"))
+            frontier_name = value;
+        else
+            search_usage(argv[0]);
+    }
+    if (trace_name == NULL || min_size <= 0 || max_size < min_size || worker_count <= 0 || set_choice_count == 0 || block_choice_count == 0)
+        search_usage(argv[0]);
+    // positive margin keeps candidates with equal prefix results from pruning each other
+    if (prune_margin <= 0)
+        search_usage(argv[0]);
+
+    buildcandidates();
+    if (prefix_records > 0)
+        prunedominated();
+    if (objective == OBJ_MISS)
+        searchmiss();
+    else if (objective == OBJ_IPC)
+        searchipc();
+    else
+        searchfrontier();
+
+    // pick best: smallest size meeting target (then lowest miss rate) / highest IPC within budget
+    for (int i = 0; i < candidate_count; i++) {
+        c = &candidate[i];
+        if (!c->evaluated)
+            continue;
+        if (objective == OBJ_MISS && c->miss_rate <= target_miss_rate
+            && (!best || c->cache_size < best->cache_size || (c->cache_size == best->cache_size && c->miss_rate < best->miss_rate)))
+            best = c;
+        if (objective == OBJ_IPC && c->cache_size <= size_budget && (!best || c->ipc > best->ipc))
+            best = c;
+    }
+
+    fprintf(stderr, "%d candidates, %d simulated over whole trace\n", candidate_count, full_eval_count);
+    if (best)
+        fprintf(stderr, "best: -s=%d -a=%d -b=%d %s (miss rate %.2f%%, IPC %.5f)\n", best->cache_size, best->set_size, best->block_size,
+            policy[best->policy], best->miss_rate, best->ipc);
+    else if (objective != OBJ_FRONTIER)
+        fputs("no configuration meets objective\n", stderr);
+    writefrontier(frontier_name, best);
+
+    return (objective != OBJ_FRONTIER && !best) ? 1 : 0;
+}
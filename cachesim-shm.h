@@ -0,0 +1,128 @@
+// file: cachesim-shm.h
+// author : Ryu Hyung Uk
+// description : Shared-memory trace ring buffer used by cachesim-onelevel (-m=<name>)
+// usage: include from the producer (instrumentation tool), link with -lrt
+//
+// Memory layout of the shared-memory object (all fields are native-endian):
+//
+//   offset   0 : SHMRING header line   (magic, version, capacity, closed)
+//   offset  64 : producer line         (head, cached tail)
+//   offset 128 : consumer line         (tail, attached)
+//   offset 192 : SHMRECORD[capacity]   (16 bytes each)
+//
+// head and tail are free-running record counters. The producer owns head and
+// the consumer owns tail, record i lives in slot (i & (capacity - 1)).
+// The ring is empty when head == tail and full when head - tail == capacity.
+// The producer sets closed after its last record, the consumer stops once the
+// ring is drained and closed is set, then unlinks the shared-memory object.
+// The producer replaces any object left behind under the same name (consumer
+// killed before unlinking), and a consumer skips rings another consumer has
+// already attached to, so a leftover object is never resumed.
+
+#ifndef CACHESIM_SHM_H
+#define CACHESIM_SHM_H
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L // shm_open, ftruncate and sched_yield under strict -std=c99
+#endif
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SHM_MAGIC 0x52534D43 // "CMSR"
+#define SHM_VERSION 1
+#define SHM_LOAD 0 // same encoding as insType column of trace file
+#define SHM_STORE 1
+
+
+// define structure
+typedef struct SHMRECORD {
+    uint64_t address; // 64-Bit physical memory address
+    uint32_t insCnt; // non-memory-access instructions executed after this access
+    uint32_t insType; // SHM_LOAD or SHM_STORE
+} SHMRECORD;
+
+typedef struct SHMRING {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity; // number of records, must be power of 2
+    uint32_t closed; // set by producer after last record
+    char pad0[44];
+
+    uint64_t head; // records published by producer
+    uint64_t tail_cache; // producer-private copy of tail
+    char pad1[48];
+
+    uint64_t tail; // records consumed by consumer
+    uint32_t attached; // set by consumer when it attaches
+    char pad2[52];
+
+    SHMRECORD record[];
+} SHMRING;
+
+
+// return size of shared-memory object which holds capacity records
+static inline size_t shm_ring_size(uint64_t capacity) {
+    return sizeof(SHMRING) + sizeof(SHMRECORD) * capacity;
+}
+
+// create ring buffer named name (ex. "/cachesim") with capacity records, return NULL on failure
+static inline SHMRING* shm_ring_create(const char* name, uint64_t capacity) {
+    SHMRING* ring = NULL;
+    int fd = -1;
+
+    if (capacity == 0 || (capacity & (capacity - 1)))
+        return NULL;
+
+    // never reuse object of earlier run, whose consumer may have been killed
+    shm_unlink(name);
+    fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0)
+        return NULL;
+    if (ftruncate(fd, shm_ring_size(capacity)) < 0) {
+        close(fd);
+        return NULL;
+    }
+    ring = (SHMRING*)mmap(NULL, shm_ring_size(capacity), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ring == MAP_FAILED)
+        return NULL;
+
+    // new object is zero-filled: head, tail, closed and attached start at 0
+    ring->capacity = capacity;
+    ring->version = SHM_VERSION;
+    // publish magic last so that consumer never sees half-initialized header
+    __atomic_store_n(&ring->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+    return ring;
+}
+
+// append one record, spin while ring is full
+static inline void shm_ring_push(SHMRING* ring, uint32_t insType, uint32_t insCnt, uint64_t address) {
+    uint64_t head = ring->head;
+    SHMRECORD* rec = NULL;
+
+    // only re-read consumer's tail when cached copy says ring is full
+    while (head - ring->tail_cache >= ring->capacity) {
+        ring->tail_cache = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (head - ring->tail_cache >= ring->capacity)
+            sched_yield();
+    }
+
+    rec = &ring->record[head & (ring->capacity - 1)];
+    rec->address = address;
+    rec->insCnt = insCnt;
+    rec->insType = insType;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// mark end of trace and unmap ring (consumer unlinks the object)
+static inline void shm_ring_close(SHMRING* ring) {
+    __atomic_store_n(&ring->closed, 1, __ATOMIC_RELEASE);
+    munmap(ring, shm_ring_size(ring->capacity));
+}
+
+#endif